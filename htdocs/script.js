@@ -2,6 +2,7 @@ document.addEventListener("DOMContentLoaded", function () {
   const searchBox = document.getElementById("searchBox");
   const suggestions = document.getElementById("suggestions");
   const uploadInput = document.getElementById("wordFile");
+  const appendWords = document.getElementById("appendWords");
   const saveSearchButton = document.getElementById("saveSearchButton");
 
   // Username handling
@@ -25,7 +26,9 @@ document.addEventListener("DOMContentLoaded", function () {
       const reader = new FileReader();
       reader.onload = function (e) {
         const fileContent = e.target.result;
-        const fullUrl = `/cgi-bin/search.cgi?user=${encodeURIComponent(currentUsername)}&filename=${encodeURIComponent(file.name)}`;
+        let fullUrl = `/cgi-bin/search.cgi?user=${encodeURIComponent(currentUsername)}&filename=${encodeURIComponent(file.name)}`;
+        // Appending only adds the new words to the current list's index instead of rebuilding it
+        if (appendWords && appendWords.checked) fullUrl += "&append=1";
 
         fetch(fullUrl, {
           method: "POST",
@@ -51,31 +54,52 @@ document.addEventListener("DOMContentLoaded", function () {
     const username = currentUsername || "guest";
     const searchUrl = `/cgi-bin/search.cgi?query=${encodeURIComponent(query)}&user=${encodeURIComponent(username)}&log=0`;
 
+    // Adds one page of results; a "next: <token>" line means more can be fetched
+    function showPage(data) {
+      const lines = data.split("\n");
+      lines.filter(line => line.startsWith(" - ")).forEach(line => {
+        const item = document.createElement("li");
+        item.textContent = line.replace(" - ", "");
+
+        item.addEventListener("click", () => {
+          const chosen = item.textContent;
+          searchBox.value = chosen;
+          suggestions.innerHTML = "";
+
+          // (MODIFIED) Show the icon and ensure it's in the default state
+          saveSearchButton.style.display = 'block';
+          saveSearchButton.disabled = false;
+          saveSearchButton.classList.remove('saved');
+
+          const clickUrl = `/cgi-bin/search.cgi?query=${encodeURIComponent(chosen)}&user=${encodeURIComponent(username)}&log=1`;
+          fetch(clickUrl);
+        });
+        suggestions.appendChild(item);
+      });
+
+      const nextLine = lines.find(line => line.startsWith("next: "));
+      if (nextLine) {
+        const more = document.createElement("li");
+        more.className = "show-more";
+        more.textContent = "Show more…";
+        more.addEventListener("click", () => {
+          const token = nextLine.substring("next: ".length);
+          fetch(`${searchUrl}&cursor=${encodeURIComponent(token)}`)
+            .then(response => response.text())
+            .then(page => {
+              more.remove();
+              showPage(page);
+            });
+        });
+        suggestions.appendChild(more);
+      }
+    }
+
     fetch(searchUrl)
       .then(response => response.text())
       .then(data => {
         suggestions.innerHTML = "";
-        const lines = data.split("\n").filter(line => line.startsWith(" - "));
-
-        lines.forEach(line => {
-          const item = document.createElement("li");
-          item.textContent = line.replace(" - ", "");
-
-          item.addEventListener("click", () => {
-            const chosen = item.textContent;
-            searchBox.value = chosen;
-            suggestions.innerHTML = "";
-
-            // (MODIFIED) Show the icon and ensure it's in the default state
-            saveSearchButton.style.display = 'block';
-            saveSearchButton.disabled = false;
-            saveSearchButton.classList.remove('saved');
-
-            const clickUrl = `/cgi-bin/search.cgi?query=${encodeURIComponent(chosen)}&user=${encodeURIComponent(username)}&log=1`;
-            fetch(clickUrl);
-          });
-          suggestions.appendChild(item);
-        });
+        showPage(data);
       });
   });
 
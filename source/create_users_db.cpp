@@ -30,6 +30,16 @@ int main() {
                                   "FOREIGN KEY(username) REFERENCES users(username));";
 
     rc = sqlite3_exec(db, historyTableSQL, 0, 0, &errMsg);
+
+    // --- Create search_recency table (decayed per-term search counters) ---
+    const char *recencyTableSQL = "CREATE TABLE IF NOT EXISTS search_recency ("
+                                  "username TEXT NOT NULL,"
+                                  "term TEXT NOT NULL,"
+                                  "score REAL NOT NULL,"
+                                  "updated INTEGER NOT NULL,"
+                                  "PRIMARY KEY(username, term));";
+
+    rc = sqlite3_exec(db, recencyTableSQL, 0, 0, &errMsg);
     
     // --- Create uploads table ---
     const char *uploadTableSQL = "CREATE TABLE IF NOT EXISTS uploads ("
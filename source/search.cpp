@@ -3,6 +3,7 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sqlite3.h>
 #include <cstdlib>
 #include <algorithm>
@@ -10,177 +11,2914 @@
 #include <iomanip>
 #include <map>
 #include <cctype> 
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iterator>
+#include "unicode_tables.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <csignal>
+#include <cerrno>
+#endif
 using namespace std;
 
+// --- TEXT NORMALIZATION ---
+// Words and queries match on a folded key: NFC-normalized, case-folded UTF-8 (see foldKey)
+// -DSEARCH_STRIP_ACCENTS=1 or --strip-accents also drops combining marks, so "cafe" finds "café"
+#ifndef SEARCH_STRIP_ACCENTS
+#define SEARCH_STRIP_ACCENTS 0
+#endif
+bool stripAccents = SEARCH_STRIP_ACCENTS;
+
+// Branch-free kernels copying n bytes with A-Z lowered; true if all were ASCII (dst is then folded)
+inline unsigned char lowerByte(unsigned char c) {
+    return static_cast<unsigned char>(c + ((static_cast<unsigned char>(c - 'A') < 26) << 5));
+}
+
+bool lowerAsciiScalar(const char* src, size_t n, char* dst) {
+    unsigned char high = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = static_cast<unsigned char>(src[i]);
+        high |= c;
+        dst[i] = static_cast<char>(lowerByte(c));
+    }
+    return high < 0x80;
+}
+
+#ifdef __SSE2__
+// Bytes >= 0x80 are negative as signed chars, so they never fall in 'A'..'Z'
+inline __m128i lowerBlock(__m128i v) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+bool lowerAsciiSse2(const char* src, size_t n, char* dst) {
+    __m128i high = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), lowerBlock(v));
+        high = _mm_or_si128(high, v);
+    }
+    bool tailAscii = lowerAsciiScalar(src + i, n - i, dst + i);
+    return tailAscii && _mm_movemask_epi8(high) == 0;
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2"))) bool lowerAsciiAvx2(const char* src, size_t n, char* dst) {
+    const __m256i before = _mm256_set1_epi8('A' - 1), after = _mm256_set1_epi8('Z' + 1), bit = _mm256_set1_epi8(0x20);
+    __m256i high = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before), _mm256_cmpgt_epi8(after, v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi8(v, _mm256_and_si256(upper, bit)));
+        high = _mm256_or_si256(high, v);
+    }
+    bool tailAscii = lowerAsciiScalar(src + i, n - i, dst + i);
+    return tailAscii && _mm256_movemask_epi8(high) == 0;
+}
+#endif
+
+typedef bool (*LowerAsciiKernel)(const char* src, size_t n, char* dst);
+
+LowerAsciiKernel pickLowerAscii() {
+#ifdef HAVE_AVX2_KERNEL
+    __builtin_cpu_init(); // runs before main, ahead of the constructor that would do this
+    if (__builtin_cpu_supports("avx2")) return lowerAsciiAvx2;
+#endif
+#ifdef __SSE2__
+    return lowerAsciiSse2;
+#else
+    return lowerAsciiScalar;
+#endif
+}
+const LowerAsciiKernel lowerAscii = pickLowerAscii(); // the fastest this CPU supports
+
+const uint32_t RAW_BYTE = 0x110000; // RAW_BYTE + b stands for an invalid byte b
+
+// Decodes the code point at text[i], advancing i
+uint32_t decodeUtf8(const char* text, size_t length, size_t& i) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(text);
+    unsigned char lead = s[i];
+    size_t extra = lead >= 0xF0 && lead < 0xF5 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC2 ? 1 : 0;
+    if (lead < 0x80 || extra == 0) {
+        i++;
+        return lead < 0x80 ? lead : RAW_BYTE + lead;
+    }
+    uint32_t cp = lead & (0x3F >> extra);
+    for (size_t k = 1; k <= extra; k++) {
+        if (i + k >= length || (s[i + k] & 0xC0) != 0x80) {
+            i++;
+            return RAW_BYTE + lead;
+        }
+        cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+    if ((extra == 2 && (cp < 0x800 || (cp >= 0xD800 && cp < 0xE000))) || (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF))) {
+        i++;
+        return RAW_BYTE + lead;
+    }
+    i += extra + 1;
+    return cp;
+}
+
+void encodeUtf8(uint32_t cp, string& out) {
+    if (cp >= RAW_BYTE) {
+        out.push_back(static_cast<char>(cp - RAW_BYTE));
+    } else if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Simple (one code point) case folding of a non-ASCII code point
+uint32_t foldSimple(uint32_t cp) {
+    const CaseFoldRun* end = CASE_FOLD_RUNS + sizeof(CASE_FOLD_RUNS) / sizeof(CASE_FOLD_RUNS[0]);
+    const CaseFoldRun* run = upper_bound(CASE_FOLD_RUNS, end, cp,
+                                         [](uint32_t c, const CaseFoldRun& r) { return c < r.first; });
+    if (run == CASE_FOLD_RUNS) return cp;
+    run--;
+    if (cp > run->last || (run->stride > 1 && (cp - run->first) % run->stride != 0)) return cp;
+    return static_cast<uint32_t>(static_cast<int32_t>(cp) + run->delta);
+}
+
+uint8_t combiningClass(uint32_t cp) {
+    if (cp >= 0x300 && cp < 0x370) return COMBINING_CLASSES[cp - 0x300];
+    return cp >= 0x483 && cp <= 0x487 ? 230 : 0; // Cyrillic titlo and friends
+}
+
+// Appends cp's full canonical decomposition
+void decomposeInto(uint32_t cp, vector<uint32_t>& out) {
+    const Decomposition* end = DECOMPOSITIONS + sizeof(DECOMPOSITIONS) / sizeof(DECOMPOSITIONS[0]);
+    const Decomposition* d = lower_bound(DECOMPOSITIONS, end, cp,
+                                         [](const Decomposition& x, uint32_t c) { return x.composed < c; });
+    if (d == end || d->composed != cp) {
+        out.push_back(cp);
+        return;
+    }
+    decomposeInto(d->base, out);
+    if (d->mark) out.push_back(d->mark);
+}
+
+// The canonical composition of base and mark, or 0
+uint32_t composePair(uint32_t base, uint32_t mark) {
+    const uint32_t S_BASE = 0xAC00, L_BASE = 0x1100, V_BASE = 0x1161, T_BASE = 0x11A7;
+    if (base >= L_BASE && base < L_BASE + 19 && mark >= V_BASE && mark < V_BASE + 21) {
+        return S_BASE + ((base - L_BASE) * 21 + (mark - V_BASE)) * 28;
+    }
+    if (base >= S_BASE && base < S_BASE + 11172 && (base - S_BASE) % 28 == 0 && mark > T_BASE && mark < T_BASE + 28) {
+        return base + (mark - T_BASE);
+    }
+    static const vector<Decomposition> byPair = [] {
+        vector<Decomposition> pairs(begin(DECOMPOSITIONS), end(DECOMPOSITIONS));
+        sort(pairs.begin(), pairs.end(), [](const Decomposition& a, const Decomposition& b) {
+            return a.base != b.base ? a.base < b.base : a.mark < b.mark;
+        });
+        return pairs;
+    }();
+    auto it = lower_bound(byPair.begin(), byPair.end(), make_pair(base, mark), [](const Decomposition& d, const pair<uint32_t, uint32_t>& key) {
+        return d.base != key.first ? d.base < key.first : d.mark < key.second;
+    });
+    return it != byPair.end() && it->base == base && it->mark == mark ? it->composed : 0;
+}
+
+// Sorts each run of combining marks by combining class (canonical order)
+void reorderMarks(vector<uint32_t>& points) {
+    for (size_t i = 0; i < points.size();) {
+        if (!combiningClass(points[i])) {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < points.size() && combiningClass(points[j])) j++;
+        stable_sort(points.begin() + i, points.begin() + j,
+                    [](uint32_t a, uint32_t b) { return combiningClass(a) < combiningClass(b); });
+        i = j;
+    }
+}
+
+// Appends the folded key of text to out: NFC(casefold(NFD(text))), less the combining
+// marks if stripAccents
+void foldKey(const char* text, size_t length, string& out) {
+    size_t start = out.size();
+    out.resize(start + length);
+    if (lowerAscii(text, length, &out[start])) return;
+    out.resize(start);
+
+    // Decompose, then case fold (folding can expand a code point or turn a mark into a
+    // letter, so its output is decomposed and reordered again)
+    thread_local vector<uint32_t> decomposed, points;
+    decomposed.clear();
+    points.clear();
+    for (size_t i = 0; i < length;) decomposeInto(decodeUtf8(text, length, i), decomposed);
+    reorderMarks(decomposed);
+    const CaseFoldExpansion* expansionsEnd = CASE_FOLD_EXPANSIONS + sizeof(CASE_FOLD_EXPANSIONS) / sizeof(CASE_FOLD_EXPANSIONS[0]);
+    for (uint32_t cp : decomposed) {
+        if (cp < 0x80) {
+            points.push_back(lowerByte(static_cast<unsigned char>(cp)));
+            continue;
+        }
+        if (cp < RAW_BYTE) {
+            const CaseFoldExpansion* e = lower_bound(CASE_FOLD_EXPANSIONS, expansionsEnd, cp,
+                                                     [](const CaseFoldExpansion& x, uint32_t c) { return x.codePoint < c; });
+            if (e != expansionsEnd && e->codePoint == cp) {
+                size_t n = strlen(e->folded);
+                for (size_t k = 0; k < n;) decomposeInto(decodeUtf8(e->folded, n, k), points);
+                continue;
+            }
+            cp = foldSimple(cp);
+        }
+        decomposeInto(cp, points);
+    }
+    reorderMarks(points);
+    if (stripAccents) {
+        points.erase(remove_if(points.begin(), points.end(), [](uint32_t cp) { return cp >= 0x300 && cp < 0x370; }),
+                     points.end());
+    }
+
+    // Canonical composition: a mark joins the last starter unless a mark of the same or a
+    // higher class (or another starter) stands between them
+    size_t kept = 0, starter = SIZE_MAX;
+    uint8_t lastClass = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        uint32_t cp = points[i];
+        uint8_t cls = combiningClass(cp);
+        if (starter != SIZE_MAX && (kept == starter + 1 || (lastClass != 0 && lastClass < cls))) {
+            uint32_t composed = composePair(points[starter], cp);
+            if (composed) {
+                points[starter] = composed;
+                continue;
+            }
+        }
+        if (cls == 0) starter = kept;
+        lastClass = cls;
+        points[kept++] = cp;
+    }
+    for (size_t i = 0; i < kept; i++) encodeUtf8(points[i], out);
+}
+
+string foldKey(const string& text) {
+    string key;
+    key.reserve(text.size());
+    foldKey(text.data(), text.size(), key);
+    return key;
+}
+
+
 // --- TRIE DATA STRUCTURE ---
+// Child storage is chosen with -DTRIE_NODE_LAYOUT; every layout visits children in byte order
+#define TRIE_LAYOUT_SORTED 1   // sorted key/child arrays, linear (SSE2) search
+#define TRIE_LAYOUT_DENSE 2    // 256-entry child table per node
+#define TRIE_LAYOUT_ADAPTIVE 3 // sorted arrays up to 16 children, dense table above that
+#ifndef TRIE_NODE_LAYOUT
+#define TRIE_NODE_LAYOUT TRIE_LAYOUT_ADAPTIVE
+#endif
+
+// Single-child chains collapse into labelled edges (a radix trie); 0 for one node per character
+#ifndef TRIE_PATH_COMPRESSION
+#define TRIE_PATH_COMPRESSION 1
+#endif
+
+// Best completions stored per node, so a short suggestion is a prefix walk; 0 disables them
+#ifndef TRIE_TOP_K
+#define TRIE_TOP_K 20 // the largest suggestions_count settings.html allows
+#endif
+
+// fuzzy=k allows FUZZY_MAX_EDITS typos and about FUZZY_VISIT_BUDGET steps (characters and completions)
+#ifndef FUZZY_MAX_EDITS
+#define FUZZY_MAX_EDITS 2
+#endif
+#ifndef FUZZY_VISIT_BUDGET
+#define FUZZY_VISIT_BUDGET 50000
+#endif
+
+#if TRIE_NODE_LAYOUT == TRIE_LAYOUT_ADAPTIVE
+const size_t TRIE_MAX_SORTED = 16;
+#elif TRIE_NODE_LAYOUT == TRIE_LAYOUT_SORTED
+const size_t TRIE_MAX_SORTED = 256;
+#else
+const size_t TRIE_MAX_SORTED = 0;
+#endif
+
+// Index of ch in keys[0..count), or -1
+inline int findKey(const unsigned char* keys, size_t count, unsigned char ch) {
+#ifdef __SSE2__
+    size_t i = 0;
+    __m128i needle = _mm_set1_epi8(static_cast<char>(ch));
+    for (; i + 16 <= count; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) return static_cast<int>(i) + __builtin_ctz(mask);
+    }
+    for (; i < count; i++) {
+        if (keys[i] == ch) return static_cast<int>(i);
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        if (keys[i] == ch) return static_cast<int>(i);
+    }
+#endif
+    return -1;
+}
+
+// Node addressed by index into TrieArena::nodes; 0 is the root, so it also means "no child"
 struct TrieNode {
-    map<char, TrieNode*> children;
+    uint32_t childBase = 0;      // start of this node's block in the child pools
+    uint32_t labelOffset = 0;    // edge bytes after the key byte, in TrieArena::labels
+    uint32_t wordId = 0;         // index into Trie::words when isEndOfWord
+    uint16_t childCount = 0;
+    uint16_t childCapacity = 0;  // block size: a power of two, or 256 when dense
+    uint16_t labelLength = 0;
+    bool dense = false;          // block is indexed by byte instead of sorted
     bool isEndOfWord = false;
 };
+static_assert(sizeof(TrieNode) == 20, "TrieNode must stay free of padding (index files hold it as-is)");
+
+// Read-only view of a whole file: mmap where available, else an 8-byte aligned copy
+class MappedFile {
+    const char* mapped = nullptr;
+    size_t length = 0;
+    vector<uint64_t> buffer;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped && buffer.empty()) munmap(const_cast<char*>(mapped), length);
+#endif
+    }
+
+    bool open(const string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // the mapping stays valid without the descriptor
+        if (data == MAP_FAILED) return false;
+        mapped = static_cast<const char*>(data);
+        length = info.st_size;
+        return true;
+#else
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file.is_open()) return false;
+        length = static_cast<size_t>(file.tellg());
+        buffer.resize((length + 7) / 8 + 1);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(buffer.data()), length);
+        mapped = reinterpret_cast<const char*>(buffer.data());
+        return static_cast<bool>(file);
+#endif
+    }
+
+    const char* data() const { return mapped; }
+    size_t size() const { return length; }
+};
+
+// Array of plain structs, owned or viewing a mapped file; non-const access copies a view first
+template <typename T>
+class PodArray {
+    vector<T> owned;
+    const T* view = nullptr;
+    size_t count = 0;
+    bool viewing = false;
+
+    void refresh() {
+        view = owned.data();
+        count = owned.size();
+    }
+
+public:
+    PodArray() = default;
+    PodArray(const PodArray& other) : owned(other.owned), view(other.view), count(other.count), viewing(other.viewing) {
+        if (!viewing) refresh();
+    }
+    PodArray& operator=(const PodArray& other) {
+        owned = other.owned;
+        view = other.view;
+        count = other.count;
+        viewing = other.viewing;
+        if (!viewing) refresh();
+        return *this;
+    }
+
+    const T& operator[](size_t i) const { return view[i]; }
+    T& operator[](size_t i) {
+        materialize();
+        return owned[i];
+    }
+    const T* data() const { return view; }
+    T* mutableData() {
+        materialize();
+        return owned.data();
+    }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return owned.capacity(); }
+
+    void push_back(const T& value) {
+        materialize();
+        owned.push_back(value);
+        refresh();
+    }
+    void append(const T* values, size_t n) {
+        materialize();
+        owned.insert(owned.end(), values, values + n);
+        refresh();
+    }
+    void resize(size_t n) {
+        materialize();
+        owned.resize(n);
+        refresh();
+    }
+    void clear() {
+        owned.clear();
+        viewing = false;
+        refresh();
+    }
+
+    // Points the array at n elements someone else keeps alive
+    void attach(const T* values, size_t n) {
+        vector<T>().swap(owned);
+        view = values;
+        count = n;
+        viewing = true;
+    }
+    // Copies viewed elements into owned storage so they can be modified
+    void materialize() {
+        if (!viewing) return;
+        owned.assign(view, view + count);
+        viewing = false;
+        refresh();
+    }
+};
+
+// Bump allocator owning every node and child block of one Trie
+class TrieArena {
+    vector<vector<uint32_t>> freeBlocks; // outgrown child blocks, by log2(capacity)
+
+    static size_t capacityClass(size_t capacity) {
+        size_t cls = 0;
+        while ((size_t(1) << cls) < capacity) cls++;
+        return cls;
+    }
+
+public:
+    PodArray<TrieNode> nodes;
+    PodArray<unsigned char> childKeys; // sorted keys of each block (unused in dense blocks)
+    PodArray<uint32_t> childNodes;     // child node indices, parallel to childKeys
+    PodArray<char> labels;             // edge label pool
+
+    TrieArena() : freeBlocks(9) {
+        nodes.push_back(TrieNode()); // root
+    }
+
+    uint32_t allocateNode() {
+        nodes.push_back(TrieNode());
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    void materialize() {
+        nodes.materialize();
+        childKeys.materialize();
+        childNodes.materialize();
+        labels.materialize();
+    }
+
+    // Returns the base of a zeroed child block of the given (power of two) capacity
+    uint32_t allocateBlock(size_t capacity) {
+        vector<uint32_t>& freeList = freeBlocks[capacityClass(capacity)];
+        if (!freeList.empty()) {
+            uint32_t base = freeList.back();
+            freeList.pop_back();
+            fill_n(childNodes.mutableData() + base, capacity, 0);
+            return base;
+        }
+        uint32_t base = static_cast<uint32_t>(childNodes.size());
+        childKeys.resize(childKeys.size() + capacity);
+        childNodes.resize(childNodes.size() + capacity);
+        return base;
+    }
+
+    void releaseBlock(uint32_t base, size_t capacity) {
+        freeBlocks[capacityClass(capacity)].push_back(base);
+    }
+
+    size_t memoryUsage() const {
+        return nodes.capacity() * sizeof(TrieNode) + childKeys.capacity()
+             + childNodes.capacity() * sizeof(uint32_t) + labels.capacity();
+    }
+};
+
+// Vector that keeps its first N elements inline and only allocates beyond that
+template <typename T, size_t N>
+class SmallVector {
+    T local[N];
+    vector<T> overflow;
+    size_t count = 0;
+
+public:
+    void push_back(const T& value) {
+        if (count < N) local[count] = value;
+        else overflow.push_back(value);
+        count++;
+    }
+    void pop_back() {
+        count--;
+        if (count >= N) overflow.pop_back();
+    }
+    T& back() { return count <= N ? local[count - 1] : overflow.back(); }
+    T& operator[](size_t i) { return i < N ? local[i] : overflow[i - N]; }
+    const T& operator[](size_t i) const { return i < N ? local[i] : overflow[i - N]; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() {
+        count = 0;
+        overflow.clear();
+    }
+};
+
+// Resumable alphabetical walk over the words below one Trie node (see Trie::next)
+struct TrieCursor {
+    struct Frame {
+        uint32_t node;
+        uint32_t position; // 0: node's own word not yet emitted, k + 1: next child is the k-th
+    };
+    SmallVector<Frame, 32> stack;
+
+    bool done() const { return stack.empty(); }
+};
+
+// Resumable best-first walk over the completions below one Trie node (see
+// Trie::ranked). The heap holds the next unread word of each top-K list being read.
+struct RankedCursor {
+    struct Entry {
+        uint32_t wordId;
+        uint32_t node;
+        uint32_t position; // index into node's list, or UINT32_MAX for node's own word
+    };
+    uint32_t start = UINT32_MAX;
+    vector<Entry> heap;
+    uint32_t after = UINT32_MAX; // the last word taken off the heap
+    uint32_t boostedTaken = 0;   // boosted words already returned
+};
+
+// Header of a compiled index file (<upload>.idx). The arrays of a Trie follow it
+// in a fixed order, each padded to a multiple of 8 bytes.
+struct IndexHeader {
+    char magic[8];           // "ACIDX" zero-padded
+    uint32_t formatVersion;
+    uint32_t byteOrder;      // INDEX_BYTE_ORDER as written by the building machine
+    uint32_t flags;          // INDEX_PATH_COMPRESSION, INDEX_SCORED, INDEX_ACCENTS_STRIPPED
+    uint32_t topK;
+    uint32_t reserved[2];
+    int64_t sourceMtime;     // the word list this index was compiled from
+    int64_t sourceSize;
+    uint64_t counts[9];      // element count of each array
+    uint64_t checksum;       // FNV-1a over everything after the header
+};
+static_assert(sizeof(IndexHeader) == 128, "IndexHeader must stay free of padding");
+
+const char INDEX_MAGIC[8] = "ACIDX";
+const uint32_t INDEX_FORMAT_VERSION = 2; // 2: keys are Unicode-folded (see foldKey)
+const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+const uint32_t INDEX_PATH_COMPRESSION = 1;
+const uint32_t INDEX_SCORED = 2;
+const uint32_t INDEX_ACCENTS_STRIPPED = 4; // built with --strip-accents
+
+inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+// A word as a pointer into someone else's buffer (e.g. a mapped word list) and a
+// length, with its score
+struct WordSpan {
+    const char* text;
+    size_t length;
+    uint32_t score;
+};
+
+const size_t PARALLEL_BUILD_MIN_WORDS = 100000; // smaller lists are bulk-loaded on one thread
+
+// Calls f(0) .. f(threads - 1), each on its own thread (or f(0) alone for one thread)
+template <typename F>
+void runOnThreads(unsigned threads, F f) {
+    if (threads <= 1) {
+        f(0);
+        return;
+    }
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) workers.emplace_back(f, t);
+    for (auto& worker : workers) worker.join();
+}
+
+// Sorts [first, last) on up to `threads` threads: equal slices are sorted concurrently
+// and then merged pairwise
+template <typename It, typename Less>
+void parallelSort(It first, It last, Less less, unsigned threads) {
+    size_t n = last - first;
+    if (threads <= 1 || n < 2 * threads) {
+        sort(first, last, less);
+        return;
+    }
+    vector<It> bounds;
+    for (unsigned t = 0; t <= threads; t++) bounds.push_back(first + n * t / threads);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] { sort(bounds[t], bounds[t + 1], less); });
+    }
+    for (auto& worker : workers) worker.join();
+    for (size_t width = 1; width < threads; width *= 2) {
+        for (size_t t = 0; t + width < threads; t += 2 * width) {
+            inplace_merge(bounds[t], bounds[t + width], bounds[min<size_t>(t + 2 * width, threads)], less);
+        }
+    }
+}
+
+class Trie {
+    TrieArena arena;
+    bool pathCompression;
+ 
+    // Words in their original casing, by word ID, as slices of one string pool
+    struct WordRef {
+        uint32_t offset;
+        uint32_t length;
+    };
+    PodArray<char> wordPool;
+    PodArray<WordRef> words;
+    PodArray<uint32_t> wordScores;    // by word ID
+
+    // Precomputed best completions: node n's list is topIds[topStart[n] .. topStart[n + 1])
+    size_t topK = 0;                  // 0 while not built (or invalidated by insert)
+    bool scored = false;              // some word has a nonzero score (set with the lists)
+    PodArray<uint32_t> topStart;
+    PodArray<uint32_t> topIds;
+
+    // Keeps the index file alive while the arrays above view it (see mapIndex)
+    shared_ptr<MappedFile> mapping;
+
+    // Turns a trie opened with mapIndex into an ordinary, modifiable one
+    void materialize() {
+        if (!mapping) return;
+        arena.materialize();
+        wordPool.materialize();
+        words.materialize();
+        wordScores.materialize();
+        topStart.materialize();
+        topIds.materialize();
+        mapping.reset();
+    }
+
+    uint32_t findChild(uint32_t node, unsigned char ch) const {
+        const TrieNode& n = nodeAt(node);
+        if (n.dense) return arena.childNodes[n.childBase + ch];
+        int i = findKey(arena.childKeys.data() + n.childBase, n.childCount, ch);
+        return i < 0 ? 0 : arena.childNodes[n.childBase + i];
+    }
+
+    void addChild(uint32_t node, unsigned char ch, uint32_t child) {
+        TrieNode n = arena.nodes[node];
+        if (n.childCount == n.childCapacity) {
+            // Grow into a block twice the size (or a dense one) and recycle the old block
+            bool dense = n.childCount >= TRIE_MAX_SORTED;
+            size_t capacity = dense ? 256 : max<size_t>(2, n.childCapacity * 2);
+            uint32_t base = arena.allocateBlock(capacity);
+            for (size_t i = 0; i < n.childCount; i++) {
+                if (dense) {
+                    arena.childNodes[base + arena.childKeys[n.childBase + i]] = arena.childNodes[n.childBase + i];
+                } else {
+                    arena.childKeys[base + i] = arena.childKeys[n.childBase + i];
+                    arena.childNodes[base + i] = arena.childNodes[n.childBase + i];
+                }
+            }
+            if (n.childCapacity) arena.releaseBlock(n.childBase, n.childCapacity);
+            n.childBase = base;
+            n.childCapacity = static_cast<uint16_t>(capacity);
+            n.dense = dense;
+        }
+        if (n.dense) {
+            arena.childNodes[n.childBase + ch] = child;
+        } else {
+            unsigned char* keys = &arena.childKeys[n.childBase];
+            uint32_t* nodes = &arena.childNodes[n.childBase];
+            size_t pos = lower_bound(keys, keys + n.childCount, ch) - keys;
+            copy_backward(keys + pos, keys + n.childCount, keys + n.childCount + 1);
+            copy_backward(nodes + pos, nodes + n.childCount, nodes + n.childCount + 1);
+            keys[pos] = ch;
+            nodes[pos] = child;
+        }
+        n.childCount++;
+        arena.nodes[node] = n;
+    }
+
+    // Calls visit(ch, child) in key order until it returns false
+    template <typename Visit>
+    bool forEachChild(uint32_t node, Visit visit) const {
+        const TrieNode& n = nodeAt(node);
+        if (n.dense) {
+            for (int ch = 0; ch < 256; ch++) {
+                uint32_t child = arena.childNodes[n.childBase + ch];
+                if (child && !visit(static_cast<unsigned char>(ch), child)) return false;
+            }
+            return true;
+        }
+        for (size_t i = 0; i < n.childCount; i++) {
+            if (!visit(arena.childKeys[n.childBase + i], arena.childNodes[n.childBase + i])) return false;
+        }
+        return true;
+    }
+
+    // Node i; on a mapped index, a node whose offsets leave their arrays reads as an empty leaf
+    const TrieNode& nodeAt(uint32_t i) const {
+        if (!mapping) return arena.nodes[i];
+        static const TrieNode missing;
+        if (i >= arena.nodes.size()) return missing;
+        const TrieNode& n = arena.nodes[i];
+        bool inBounds = uint64_t(n.labelOffset) + n.labelLength <= arena.labels.size() &&
+                        uint64_t(n.childBase) + n.childCapacity <= arena.childNodes.size() &&
+                        (n.dense ? n.childCapacity == 256 : n.childCount <= n.childCapacity) &&
+                        (!n.isEndOfWord || n.wordId < words.size());
+        return inBounds ? n : missing;
+    }
+
+    // node's top-K list as [first, second) in topIds; empty on a mapped index if it is out of range
+    pair<uint32_t, uint32_t> topRange(uint32_t node) const {
+        if (!mapping) return {topStart[node], topStart[node + 1]};
+        if (node >= arena.nodes.size() || topStart[node] > topStart[node + 1] || topStart[node + 1] > topIds.size()) return {0, 0};
+        for (uint32_t i = topStart[node]; i < topStart[node + 1]; i++) {
+            if (topIds[i] >= words.size()) return {0, 0};
+        }
+        return {topStart[node], topStart[node + 1]};
+    }
+
+    string_view wordText(uint32_t id) const {
+        if (mapping && uint64_t(words[id].offset) + words[id].length > wordPool.size()) return string_view();
+        return string_view(wordPool.data() + words[id].offset, words[id].length);
+    }
+    string word(uint32_t id) const {
+        return string(wordText(id));
+    }
+
+    // Suggestion order: higher score first, then by folded key, the order of the trie
+    // itself (and of the alphabetical ranks buildTopCompletions breaks ties with)
+    bool ranksBefore(uint32_t a, uint32_t b) const {
+        return ranksBefore(a, wordScores[a], b, wordScores[b]);
+    }
+    bool ranksBefore(uint32_t a, uint64_t scoreA, uint32_t b, uint64_t scoreB) const {
+        if (scoreA != scoreB) return scoreA > scoreB;
+        string_view textA = wordText(a), textB = wordText(b);
+        const unsigned char* x = reinterpret_cast<const unsigned char*>(textA.data());
+        const unsigned char* y = reinterpret_cast<const unsigned char*>(textB.data());
+        size_t lengthA = textA.size(), lengthB = textB.size();
+        unsigned char high = 0;
+        for (size_t i = 0; i < lengthA; i++) high |= x[i];
+        for (size_t i = 0; i < lengthB; i++) high |= y[i];
+        if (high < 0x80) {
+            // ASCII words fold to their lowercase bytes
+            return lexicographical_compare(x, x + lengthA, y, y + lengthB,
+                                           [](unsigned char p, unsigned char q) { return lowerByte(p) < lowerByte(q); });
+        }
+        thread_local string keyA, keyB;
+        keyA.clear();
+        keyB.clear();
+        foldKey(reinterpret_cast<const char*>(x), lengthA, keyA);
+        foldKey(reinterpret_cast<const char*>(y), lengthB, keyB);
+        return lexicographical_compare(keyA.begin(), keyA.end(), keyB.begin(), keyB.end(),
+                                       [](char p, char q) { return static_cast<unsigned char>(p) < static_cast<unsigned char>(q); });
+    }
+
+    // The node whose edge ends exactly at the end of lowerWord, or NO_NODE
+    uint32_t findWord(const string& lowerWord) const {
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < lowerWord.size()) {
+            node = findChild(node, lowerWord[i++]);
+            if (!node) return NO_NODE;
+            const TrieNode& n = nodeAt(node);
+            if (n.labelLength > lowerWord.size() - i ||
+                memcmp(arena.labels.data() + n.labelOffset, lowerWord.data() + i, n.labelLength) != 0) return NO_NODE;
+            i += n.labelLength;
+        }
+        return node;
+    }
+
+    // Returns the first child at or after child position `position` (advancing it), or 0
+    uint32_t childFrom(uint32_t node, uint32_t& position) const {
+        const TrieNode& n = nodeAt(node);
+        if (n.dense) {
+            for (; position < 256; position++) {
+                uint32_t child = arena.childNodes[n.childBase + position];
+                if (child) return child;
+            }
+            return 0;
+        }
+        return position < n.childCount ? arena.childNodes[n.childBase + position] : 0;
+    }
+
+    static const uint32_t NO_NODE = UINT32_MAX;
+
+    // Returns the node whose subtree holds the completions of an already lowercased
+    // prefix, or NO_NODE. The prefix may end part-way along that node's edge.
+    uint32_t findPrefix(const string& lowerPrefix) const {
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < lowerPrefix.size()) {
+            node = findChild(node, lowerPrefix[i++]);
+            if (!node) {
+                return NO_NODE;
+            }
+            const TrieNode& n = nodeAt(node);
+            for (size_t j = 0; j < n.labelLength && i < lowerPrefix.size(); j++, i++) {
+                if (lowerPrefix[i] != arena.labels[n.labelOffset + j]) return NO_NODE;
+            }
+        }
+        return node;
+    }
+
+    // Moves the tail of child's edge after `keep` label bytes into a new node below it
+    void splitEdge(uint32_t child, size_t keep) {
+        uint32_t tail = arena.allocateNode();
+        TrieNode moved = arena.nodes[child];
+        unsigned char tailKey = arena.labels[moved.labelOffset + keep];
+        moved.labelOffset += static_cast<uint32_t>(keep + 1);
+        moved.labelLength -= static_cast<uint16_t>(keep + 1);
+        arena.nodes[tail] = moved;
+
+        TrieNode head;
+        head.labelOffset = arena.nodes[child].labelOffset;
+        head.labelLength = static_cast<uint16_t>(keep);
+        arena.nodes[child] = head;
+        addChild(child, tailKey, tail);
+    }
+
+    // Heap order of a ranked walk: the best entry on top
+    auto rankedWorse() const {
+        return [this](const RankedCursor::Entry& a, const RankedCursor::Entry& b) {
+            return ranksBefore(b.wordId, a.wordId);
+        };
+    }
+
+    // Queues node's list past the words ranked up to after, opening nodes whose full list ran out
+    void rankedRead(vector<RankedCursor::Entry>& heap, uint32_t node, uint32_t position, uint32_t after) const {
+        struct Read {
+            uint32_t node, position, after;
+        };
+        // A walk resumed from scratch heapifies once at the end
+        bool resumed = heap.empty();
+        auto queue = [&](const RankedCursor::Entry& entry) {
+            heap.push_back(entry);
+            if (!resumed) push_heap(heap.begin(), heap.end(), rankedWorse());
+        };
+        vector<Read> reads(1, {node, position, after});
+        while (!reads.empty()) {
+            Read read = reads.back();
+            reads.pop_back();
+            pair<uint32_t, uint32_t> range = topRange(read.node);
+            uint32_t begin = range.first, length = range.second - begin;
+            if (read.after != NO_NODE) {
+                const uint32_t* list = topIds.data() + begin;
+                read.position = static_cast<uint32_t>(partition_point(list, list + length, [&](uint32_t id) {
+                    return !ranksBefore(read.after, id);
+                }) - list);
+            }
+            if (read.position < length) {
+                queue({topIds[begin + read.position], read.node, read.position});
+                continue;
+            }
+            if (length == 0 || length < topK) continue;
+            uint32_t last = topIds[begin + length - 1];
+            if (read.after != NO_NODE && ranksBefore(last, read.after)) last = read.after;
+            const TrieNode& n = nodeAt(read.node);
+            if (n.isEndOfWord && ranksBefore(last, n.wordId)) queue({n.wordId, read.node, NO_NODE});
+            forEachChild(read.node, [&](unsigned char, uint32_t child) {
+                reads.push_back({child, 0, last});
+                return true;
+            });
+        }
+        if (resumed) make_heap(heap.begin(), heap.end(), rankedWorse());
+    }
+
+    // Takes the best word off a ranked walk's heap
+    uint32_t rankedPop(vector<RankedCursor::Entry>& heap) const {
+        pop_heap(heap.begin(), heap.end(), rankedWorse());
+        RankedCursor::Entry entry = heap.back();
+        heap.pop_back();
+        if (entry.position != NO_NODE) rankedRead(heap, entry.node, entry.position + 1, NO_NODE);
+        return entry.wordId;
+    }
+
+public:
+    explicit Trie(bool pathCompression = TRIE_PATH_COMPRESSION) : pathCompression(pathCompression) {}
+
+    // Inserts a word into the trie. A repeated word keeps its first casing and highest score.
+    void insert(const string& word, uint32_t score = 0) {
+        insert(word.data(), word.size(), score);
+    }
+
+    // Lowercases ASCII words as it goes, so inserting them allocates nothing beyond the
+    // trie's own storage; other words are folded first (see foldKey)
+    void insert(const char* word, size_t wordLength, uint32_t score = 0) {
+        if (wordLength == 0) return;
+        materialize();
+        topK = 0;
+        thread_local string folded;
+        folded.clear();
+        foldKey(word, wordLength, folded);
+        const char* key = folded.data();
+        size_t length = folded.size();
+        if (length == 0) return;
+        auto lower = [&](size_t i) { return static_cast<unsigned char>(key[i]); };
+
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < length) {
+            unsigned char ch = lower(i++);
+            uint32_t next = findChild(node, ch);
+            if (!next) {
+                next = arena.allocateNode();
+                addChild(node, ch, next);
+                if (pathCompression) {
+                    // The rest of the word (up to the label size limit) becomes the new edge
+                    size_t labelLength = min<size_t>(length - i, UINT16_MAX);
+                    size_t offset = arena.labels.size();
+                    arena.nodes[next].labelOffset = static_cast<uint32_t>(offset);
+                    arena.nodes[next].labelLength = static_cast<uint16_t>(labelLength);
+                    arena.labels.resize(offset + labelLength);
+                    for (size_t k = 0; k < labelLength; k++) arena.labels[offset + k] = lower(i + k);
+                    i += labelLength;
+                }
+                node = next;
+                continue;
+            }
+
+            // Follow the edge label as far as it matches, splitting it at the first difference
+            const TrieNode& n = nodeAt(next);
+            size_t matched = 0;
+            while (matched < n.labelLength && i + matched < length &&
+                   static_cast<unsigned char>(arena.labels[n.labelOffset + matched]) == lower(i + matched)) {
+                matched++;
+            }
+            if (matched < n.labelLength) splitEdge(next, matched);
+            i += matched;
+            node = next;
+        }
+
+        TrieNode& end = arena.nodes[node];
+        if (!end.isEndOfWord) {
+            // First time this lowercase form is seen: keep this casing for suggestions
+            end.isEndOfWord = true;
+            end.wordId = static_cast<uint32_t>(words.size());
+            words.push_back({static_cast<uint32_t>(wordPool.size()), static_cast<uint32_t>(wordLength)});
+            wordPool.append(word, wordLength);
+            wordScores.push_back(score);
+        } else {
+            wordScores[end.wordId] = max(wordScores[end.wordId], score);
+        }
+    }
+
+    // A folded word for bulkLoad, sorted by (key, position in the list)
+    struct BulkKey {
+        uint64_t head; // first 8 bytes, big-endian, so most comparisons are one integer compare
+        uint32_t offset;
+        uint32_t length;
+        uint32_t index;
+        uint32_t score;
+    };
+
+    // Moves a separately built trie in under the root, renumbering its nodes, blocks,
+    // labels and word IDs. None of part's first bytes may already be used here.
+    void adopt(const Trie& part) {
+        materialize();
+        topK = 0;
+        uint32_t nodeOffset = static_cast<uint32_t>(arena.nodes.size() - 1); // part's root is dropped
+        uint32_t blockOffset = static_cast<uint32_t>(arena.childNodes.size());
+        uint32_t labelOffset = static_cast<uint32_t>(arena.labels.size());
+        uint32_t wordOffset = static_cast<uint32_t>(words.size());
+        uint32_t poolOffset = static_cast<uint32_t>(wordPool.size());
+
+        for (size_t i = 1; i < part.arena.nodes.size(); i++) {
+            TrieNode n = part.arena.nodes[i];
+            if (n.childCapacity) n.childBase += blockOffset;
+            if (n.labelLength) n.labelOffset += labelOffset;
+            if (n.isEndOfWord) n.wordId += wordOffset;
+            arena.nodes.push_back(n);
+        }
+        arena.childKeys.append(part.arena.childKeys.data(), part.arena.childKeys.size());
+        size_t blockEnd = arena.childNodes.size();
+        arena.childNodes.append(part.arena.childNodes.data(), part.arena.childNodes.size());
+        for (size_t i = blockEnd; i < arena.childNodes.size(); i++) {
+            if (arena.childNodes[i]) arena.childNodes[i] += nodeOffset;
+        }
+        arena.labels.append(part.arena.labels.data(), part.arena.labels.size());
+
+        for (size_t i = 0; i < part.words.size(); i++) {
+            words.push_back({part.words[i].offset + poolOffset, part.words[i].length});
+        }
+        wordPool.append(part.wordPool.data(), part.wordPool.size());
+        wordScores.append(part.wordScores.data(), part.wordScores.size());
+
+        part.forEachChild(0, [&](unsigned char ch, uint32_t child) {
+            addChild(0, ch, child + nodeOffset);
+            return true;
+        });
+    }
+
+    // Lays out keys [lo, hi) of bulkLoad's sorted, deduplicated keys in this empty trie
+    void layOut(const vector<BulkKey>& keys, size_t lo, size_t hi, const string& lowerPool, const vector<WordSpan>& spans) {
+        const unsigned char* pool = reinterpret_cast<const unsigned char*>(lowerPool.data());
+        auto byteAt = [&](size_t k, size_t depth) { return pool[keys[k].offset + depth]; };
+
+        // Gives node its label, word and child block for keys [lo, hi); returns the first key below it
+        auto fill = [&](uint32_t node, size_t lo, size_t hi, size_t& depth) {
+            TrieNode n = arena.nodes[node];
+            if (pathCompression && node != 0) {
+                size_t shared = 0, limit = min<size_t>(min(keys[lo].length, keys[hi - 1].length) - depth, UINT16_MAX);
+                while (shared < limit && byteAt(lo, depth + shared) == byteAt(hi - 1, depth + shared)) shared++;
+                n.labelOffset = static_cast<uint32_t>(arena.labels.size());
+                n.labelLength = static_cast<uint16_t>(shared);
+                arena.labels.append(lowerPool.data() + keys[lo].offset + depth, shared);
+                depth += shared;
+            }
+            if (keys[lo].length == depth) {
+                const WordSpan& original = spans[keys[lo].index];
+                n.isEndOfWord = true;
+                n.wordId = static_cast<uint32_t>(words.size());
+                words.push_back({static_cast<uint32_t>(wordPool.size()), static_cast<uint32_t>(original.length)});
+                wordPool.append(original.text, original.length);
+                wordScores.push_back(keys[lo].score);
+                lo++;
+            }
+            size_t distinct = 0;
+            for (size_t k = lo; k < hi; k++) {
+                if (k == lo || byteAt(k, depth) != byteAt(k - 1, depth)) distinct++;
+            }
+            if (distinct) {
+                n.dense = distinct > TRIE_MAX_SORTED;
+                size_t capacity = 1;
+                while (capacity < distinct) capacity *= 2;
+                n.childCapacity = static_cast<uint16_t>(n.dense ? 256 : capacity);
+                n.childBase = arena.allocateBlock(n.childCapacity);
+            }
+            arena.nodes[node] = n;
+            return lo;
+        };
+
+        // Pre-order walk over the sorted keys; each frame hands out its children one group at a time
+        struct Frame {
+            uint32_t node;
+            size_t next, hi, depth;
+        };
+        vector<Frame> stack;
+        size_t depth = 0;
+        lo = fill(0, lo, hi, depth);
+        stack.push_back({0, lo, hi, depth});
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.next == frame.hi) {
+                stack.pop_back();
+                continue;
+            }
+            size_t groupLo = frame.next, groupHi = groupLo + 1;
+            unsigned char ch = byteAt(groupLo, frame.depth);
+            while (groupHi < frame.hi && byteAt(groupHi, frame.depth) == ch) groupHi++;
+            frame.next = groupHi;
+
+            uint32_t child = arena.allocateNode();
+            TrieNode& parent = arena.nodes[frame.node];
+            if (parent.dense) {
+                arena.childNodes[parent.childBase + ch] = child;
+            } else {
+                arena.childKeys[parent.childBase + parent.childCount] = ch;
+                arena.childNodes[parent.childBase + parent.childCount] = child;
+            }
+            parent.childCount++;
+
+            depth = frame.depth + 1;
+            lo = fill(child, groupLo, groupHi, depth);
+            stack.push_back({child, lo, groupHi, depth}); // invalidates frame
+        }
+    }
+
+    // Builds an empty trie from a whole word list (on `threads` threads if it is large)
+    void bulkLoad(const vector<WordSpan>& spans, unsigned threads = 1) {
+        materialize();
+        topK = 0;
+        if (spans.empty() || arena.nodes.size() > 1) {
+            for (const auto& span : spans) insert(span.text, span.length, span.score);
+            return;
+        }
+        if (spans.size() < PARALLEL_BUILD_MIN_WORDS) threads = 1;
+
+        // Each thread folds a slice of the list into its own pool; the pools are then joined
+        vector<string> slicePools(threads);
+        vector<vector<BulkKey>> sliceKeys(threads);
+        runOnThreads(threads, [&](unsigned t) {
+            string& slicePool = slicePools[t];
+            for (size_t i = spans.size() * t / threads; i < spans.size() * (t + 1) / threads; i++) {
+                if (spans[i].length == 0) continue;
+                size_t offset = slicePool.size();
+                foldKey(spans[i].text, spans[i].length, slicePool);
+                BulkKey key = {0, static_cast<uint32_t>(offset), static_cast<uint32_t>(slicePool.size() - offset),
+                               static_cast<uint32_t>(i), spans[i].score};
+                if (key.length == 0) continue;
+                for (size_t j = 0; j < key.length && j < 8; j++) {
+                    key.head |= uint64_t(static_cast<unsigned char>(slicePool[offset + j])) << (56 - 8 * j);
+                }
+                sliceKeys[t].push_back(key);
+            }
+        });
+        string lowerPool;
+        vector<BulkKey> keys;
+        keys.reserve(spans.size());
+        for (unsigned t = 0; t < threads; t++) {
+            uint32_t base = static_cast<uint32_t>(lowerPool.size());
+            lowerPool += slicePools[t];
+            for (BulkKey key : sliceKeys[t]) {
+                key.offset += base;
+                keys.push_back(key);
+            }
+            string().swap(slicePools[t]);
+            vector<BulkKey>().swap(sliceKeys[t]);
+        }
+
+        const unsigned char* pool = reinterpret_cast<const unsigned char*>(lowerPool.data());
+        auto compare = [&](const BulkKey& a, const BulkKey& b) {
+            if (a.head != b.head) return a.head < b.head ? -1 : 1;
+            uint32_t shared = min(a.length, b.length);
+            int c = shared > 8 ? memcmp(pool + a.offset + 8, pool + b.offset + 8, shared - 8) : 0;
+            return c != 0 ? c : int(a.length) - int(b.length);
+        };
+        parallelSort(keys.begin(), keys.end(), [&](const BulkKey& a, const BulkKey& b) {
+            int c = compare(a, b);
+            return c != 0 ? c < 0 : a.index < b.index;
+        }, threads);
+        // A repeated word keeps its first casing and its highest score
+        size_t kept = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (kept > 0 && compare(keys[kept - 1], keys[i]) == 0) {
+                keys[kept - 1].score = max(keys[kept - 1].score, keys[i].score);
+            } else {
+                keys[kept++] = keys[i];
+            }
+        }
+        keys.resize(kept);
+
+        // Cut the keys between first bytes into up to `threads` ranges of similar size
+        vector<size_t> cuts = {0};
+        for (size_t k = 1; k < keys.size() && cuts.size() < threads; k++) {
+            if (k >= keys.size() * cuts.size() / threads && pool[keys[k].offset] != pool[keys[k - 1].offset]) cuts.push_back(k);
+        }
+        cuts.push_back(keys.size());
+        if (cuts.size() == 2) {
+            layOut(keys, 0, keys.size(), lowerPool, spans);
+            return;
+        }
+        vector<Trie> parts(cuts.size() - 1, Trie(pathCompression));
+        runOnThreads(static_cast<unsigned>(parts.size()), [&](unsigned r) {
+            parts[r].layOut(keys, cuts[r], cuts[r + 1], lowerPool, spans);
+        });
+        // Size the root's block for all the parts' first bytes, then adopt them in order
+        size_t distinct = 0;
+        for (const auto& part : parts) distinct += part.arena.nodes[0].childCount;
+        TrieNode root = arena.nodes[0];
+        root.dense = distinct > TRIE_MAX_SORTED;
+        size_t capacity = 1;
+        while (capacity < distinct) capacity *= 2;
+        root.childCapacity = static_cast<uint16_t>(root.dense ? 256 : capacity);
+        root.childBase = arena.allocateBlock(root.childCapacity);
+        arena.nodes[0] = root;
+        for (const auto& part : parts) adopt(part);
+    }
+
+    // Precomputes the best k completions of every node. Call after the last insert.
+    void buildTopCompletions(size_t k) {
+        materialize();
+        topK = 0;
+        topStart.clear();
+        topIds.clear();
+        if (k == 0) return;
+        size_t nodeCount = arena.nodes.size();
+        scored = false;
+        for (size_t i = 0; i < wordScores.size() && !scored; i++) scored = wordScores[i] > 0;
+
+        // Pre-order walk: gives the alphabetical rank of every word, used to break score
+        // ties, and an order in which every parent comes before its children
+        vector<uint32_t> alphaRank(words.size());
+        uint32_t rank = 0;
+        vector<uint32_t> preorder, stack = {0}, children;
+        preorder.reserve(nodeCount);
+        while (!stack.empty()) {
+            uint32_t node = stack.back();
+            stack.pop_back();
+            preorder.push_back(node);
+            if (arena.nodes[node].isEndOfWord) alphaRank[arena.nodes[node].wordId] = rank++;
+            children.clear();
+            forEachChild(node, [&](unsigned char, uint32_t child) {
+                children.push_back(child);
+                return true;
+            });
+            stack.insert(stack.end(), children.rbegin(), children.rend());
+        }
+        auto better = [&](uint32_t a, uint32_t b) {
+            if (wordScores[a] != wordScores[b]) return wordScores[a] > wordScores[b];
+            return alphaRank[a] < alphaRank[b];
+        };
+
+        // Walking the pre-order backwards sees every child's list before its parent's.
+        // First size the lists...
+        vector<uint32_t> counts(nodeCount);
+        for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+            uint32_t n = *it;
+            size_t count = arena.nodes[n].isEndOfWord ? 1 : 0;
+            forEachChild(n, [&](unsigned char, uint32_t child) {
+                count += counts[child];
+                return true;
+            });
+            counts[n] = static_cast<uint32_t>(min(count, k));
+        }
+        topStart.resize(nodeCount + 1);
+        for (size_t n = 0; n < nodeCount; n++) topStart[n + 1] = topStart[n] + counts[n];
+        topIds.resize(topStart[nodeCount]);
+
+        // ...then fill each one from the node's own word and its children's lists
+        vector<uint32_t> candidates;
+        for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+            uint32_t n = *it;
+            candidates.clear();
+            if (arena.nodes[n].isEndOfWord) candidates.push_back(arena.nodes[n].wordId);
+            forEachChild(n, [&](unsigned char, uint32_t child) {
+                candidates.insert(candidates.end(), topIds.data() + topStart[child], topIds.data() + topStart[child + 1]);
+                return true;
+            });
+            partial_sort(candidates.begin(), candidates.begin() + counts[n], candidates.end(), better);
+            copy_n(candidates.begin(), counts[n], topIds.mutableData() + topStart[n]);
+        }
+        topK = k;
+    }
+
+    // Inserts a few words, recomputing only the top-K lists of nodes they pass through
+    void append(const vector<WordSpan>& spans) {
+        if (spans.empty()) return;
+        materialize(); // insert() only does this for non-empty words
+        size_t k = topK;
+        uint32_t oldNodeCount = static_cast<uint32_t>(arena.nodes.size());
+        for (const auto& span : spans) insert(span.text, span.length, span.score); // keeps the old lists
+        if (k == 0) return;
+
+        // New nodes (leaves and the lower halves of split edges) and every node on a new word's path
+        size_t nodeCount = arena.nodes.size();
+        vector<char> touched(nodeCount, 0);
+        fill(touched.begin() + oldNodeCount, touched.end(), 1);
+        for (const auto& span : spans) {
+            if (span.length == 0) continue;
+            string lowerWord;
+            foldKey(span.text, span.length, lowerWord);
+            uint32_t node = 0;
+            touched[0] = 1;
+            for (size_t i = 0; i < lowerWord.size();) {
+                node = findChild(node, lowerWord[i]);
+                touched[node] = 1;
+                i += 1 + arena.nodes[node].labelLength;
+            }
+        }
+
+        auto better = [&](uint32_t a, uint32_t b) { return ranksBefore(a, b); };
+
+        // Post-order over the touched nodes (a touched node's parent is always touched)
+        unordered_map<uint32_t, vector<uint32_t>> lists;
+        vector<pair<uint32_t, bool>> stack = {{0, false}};
+        vector<uint32_t> candidates;
+        while (!stack.empty()) {
+            auto entry = stack.back();
+            stack.pop_back();
+            uint32_t n = entry.first;
+            if (!entry.second) {
+                stack.push_back({n, true});
+                forEachChild(n, [&](unsigned char, uint32_t child) {
+                    if (touched[child]) stack.push_back({child, false});
+                    return true;
+                });
+                continue;
+            }
+            candidates.clear();
+            if (arena.nodes[n].isEndOfWord) candidates.push_back(arena.nodes[n].wordId);
+            forEachChild(n, [&](unsigned char, uint32_t child) {
+                if (touched[child]) {
+                    candidates.insert(candidates.end(), lists[child].begin(), lists[child].end());
+                } else {
+                    candidates.insert(candidates.end(), topIds.data() + topStart[child], topIds.data() + topStart[child + 1]);
+                }
+                return true;
+            });
+            size_t count = min(candidates.size(), k);
+            partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), better);
+            lists[n].assign(candidates.begin(), candidates.begin() + count);
+        }
+
+        PodArray<uint32_t> start, ids;
+        start.resize(nodeCount + 1);
+        for (uint32_t n = 0; n < nodeCount; n++) {
+            if (touched[n]) {
+                ids.append(lists[n].data(), lists[n].size());
+            } else {
+                ids.append(topIds.data() + topStart[n], topStart[n + 1] - topStart[n]);
+            }
+            start[n + 1] = static_cast<uint32_t>(ids.size());
+        }
+        topStart = start;
+        topIds = ids;
+        topK = k;
+        for (const auto& span : spans) scored = scored || span.score > 0;
+    }
+
+    // Adds delta to the score of a word already in the trie. Rebuild the top-K lists afterwards.
+    void addScore(const string& word, uint32_t delta) {
+        string lowerWord = foldKey(word);
+        uint32_t node = findWord(lowerWord);
+        if (node == NO_NODE || !arena.nodes[node].isEndOfWord) return;
+        materialize();
+        uint32_t& score = wordScores[arena.nodes[node].wordId];
+        score = static_cast<uint32_t>(min<uint64_t>(uint64_t(score) + delta, UINT32_MAX));
+        topK = 0;
+    }
+
+    bool hasScores() const {
+        return scored;
+    }
+
+    // Starts a best-first walk over the completions of prefix (see ranked)
+    RankedCursor rankedCursor(const string& prefix) const {
+        RankedCursor cursor;
+        cursor.start = findPrefix(foldKey(prefix));
+        if (cursor.start != NO_NODE && topK > 0) rankedRead(cursor.heap, cursor.start, 0, NO_NODE);
+        return cursor;
+    }
+
+    // Appends up to count further completions of prefix from cursor to results, best
+    // first; boosts (lowercase word -> extra score) re-rank the boosted words
+    void ranked(const string& prefix, RankedCursor& cursor, size_t count, vector<string>& results,
+                const map<string, uint32_t>& boosts = {}) const {
+        if (cursor.start == NO_NODE || topK == 0) return;
+        string lowerPrefix = foldKey(prefix);
+        vector<pair<uint32_t, uint64_t>> boosted; // word ID and boosted score
+        for (const auto& boost : boosts) {
+            if (boost.first.compare(0, lowerPrefix.size(), lowerPrefix) != 0) continue;
+            uint32_t node = findWord(boost.first);
+            if (node == NO_NODE || !nodeAt(node).isEndOfWord) continue;
+            uint32_t id = nodeAt(node).wordId;
+            boosted.push_back({id, uint64_t(wordScores[id]) + boost.second});
+        }
+        auto before = [&](const pair<uint32_t, uint64_t>& a, const pair<uint32_t, uint64_t>& b) {
+            return ranksBefore(a.first, a.second, b.first, b.second);
+        };
+        sort(boosted.begin(), boosted.end(), before);
+        unordered_set<uint32_t> boostedIds;
+        for (const auto& entry : boosted) boostedIds.insert(entry.first);
+
+        vector<RankedCursor::Entry>& heap = cursor.heap;
+        size_t j = min<size_t>(cursor.boostedTaken, boosted.size());
+        for (size_t added = 0; added < count; added++) {
+            while (!heap.empty() && boostedIds.count(heap.front().wordId)) cursor.after = rankedPop(heap);
+            bool fromBoosted;
+            if (j < boosted.size() && !heap.empty()) {
+                fromBoosted = before(boosted[j], {heap.front().wordId, wordScores[heap.front().wordId]});
+            } else if (j < boosted.size() || !heap.empty()) {
+                fromBoosted = j < boosted.size();
+            } else {
+                break;
+            }
+            if (!fromBoosted) cursor.after = rankedPop(heap);
+            results.push_back(word(fromBoosted ? boosted[j++].first : cursor.after));
+        }
+        cursor.boostedTaken = static_cast<uint32_t>(j);
+    }
+
+    // The first count completions below start, best first (see ranked)
+    void rankedIds(uint32_t start, size_t count, vector<uint32_t>& results) const {
+        vector<RankedCursor::Entry> heap;
+        rankedRead(heap, start, 0, NO_NODE);
+        for (size_t added = 0; added < count && !heap.empty(); added++) results.push_back(rankedPop(heap));
+    }
+
+    // Serializes a ranked cursor as "<start>.<boosted taken>.<last word taken>" in hex
+    string saveRanked(const RankedCursor& cursor) const {
+        stringstream ss;
+        ss << hex << cursor.start << '.' << cursor.boostedTaken << '.' << cursor.after;
+        return ss.str();
+    }
+
+    // Rebuilds a cursor saved by saveRanked. Returns false if the text is malformed or
+    // was saved for another prefix.
+    bool restoreRanked(const string& prefix, const string& saved, RankedCursor& cursor) const {
+        cursor = RankedCursor();
+        unsigned long start, boostedTaken, after;
+        char extra;
+        if (sscanf(saved.c_str(), "%lx.%lx.%lx%c", &start, &boostedTaken, &after, &extra) != 3 ||
+            start != findPrefix(foldKey(prefix)) || start == NO_NODE || topK == 0 ||
+            (after >= wordScores.size() && after != NO_NODE)) return false;
+        cursor.start = static_cast<uint32_t>(start);
+        cursor.boostedTaken = static_cast<uint32_t>(min<unsigned long>(boostedTaken, UINT32_MAX));
+        cursor.after = static_cast<uint32_t>(after);
+        rankedRead(cursor.heap, cursor.start, 0, cursor.after);
+        return true;
+    }
+
+    // Returns a vector of suggestions for a given prefix
+    vector<string> suggest(const string& prefix, int limit) const {
+        string lowerPrefix = foldKey(prefix);
+
+        uint32_t node = findPrefix(lowerPrefix);
+        if (node == NO_NODE) {
+            return {}; // No suggestions found
+        }
+
+        size_t count = static_cast<size_t>(max(limit, 0));
+        vector<string> results;
+        results.reserve(count);
+        if (topK > 0 && count <= topK) {
+            pair<uint32_t, uint32_t> range = topRange(node);
+            for (uint32_t i = range.first; i < range.second && results.size() < count; i++) {
+                results.push_back(word(topIds[i]));
+            }
+            return results;
+        }
+        if (topK > 0 && scored) {
+            RankedCursor cursor = rankedCursor(prefix);
+            ranked(prefix, cursor, count, results);
+            return results;
+        }
+        TrieCursor cursor;
+        cursor.stack.push_back({node, 0});
+        next(cursor, results, count);
+        return results;
+    }
+
+    // The first count completions below node (best first with top-K lists, else alphabetical)
+    void completionIds(uint32_t node, size_t count, vector<uint32_t>& ids) const {
+        if (topK > 0 && count <= topK) {
+            pair<uint32_t, uint32_t> range = topRange(node);
+            for (uint32_t i = range.first; i < range.second && ids.size() < count; i++) ids.push_back(topIds[i]);
+            return;
+        }
+        if (topK > 0) {
+            rankedIds(node, count, ids);
+            return;
+        }
+        vector<uint32_t> stack(1, node);
+        size_t added = 0;
+        while (!stack.empty() && added < count) {
+            uint32_t next = stack.back();
+            stack.pop_back();
+            if (nodeAt(next).isEndOfWord) {
+                ids.push_back(nodeAt(next).wordId);
+                added++;
+            }
+            size_t mark = stack.size();
+            forEachChild(next, [&](unsigned char, uint32_t child) {
+                stack.push_back(child);
+                return true;
+            });
+            reverse(stack.begin() + mark, stack.end());
+        }
+    }
+
+    // Suggestions for a prefix typed with up to maxEdits typos (insertions, deletions or
+    // substitutions), ordered by edit distance, then as usual
+    vector<string> fuzzySuggest(const string& prefix, int maxEdits, int limit,
+                                size_t budget = FUZZY_VISIT_BUDGET) const {
+        string lowerPrefix = foldKey(prefix);
+        const size_t m = lowerPrefix.size();
+        const size_t width = m + 1;
+        if (limit <= 0 || maxEdits < 0) return {};
+
+        vector<pair<int, uint32_t>> matches; // distance and node
+        // One edit distance row per path character: row[j] compares the path with prefix[0, j)
+        vector<int> rows(width);
+        for (size_t j = 0; j <= m; j++) rows[j] = static_cast<int>(j);
+        int rootBound = maxEdits + 1;
+        if (m <= static_cast<size_t>(maxEdits)) {
+            rootBound = static_cast<int>(m);
+            matches.push_back({rootBound, 0});
+        }
+
+        struct Frame {
+            uint32_t node;
+            uint32_t depth; // path length above the node's edge
+            int bound;      // distance of the closest match above, or maxEdits + 1
+            unsigned char ch;
+        };
+        vector<Frame> stack;
+        auto pushChildren = [&](uint32_t node, size_t depth, int bound) {
+            uint32_t typed = 0;
+            unsigned char typedCh = 0;
+            forEachChild(node, [&](unsigned char ch, uint32_t child) {
+                if (depth < m && ch == static_cast<unsigned char>(lowerPrefix[depth])) {
+                    typed = child;
+                    typedCh = ch;
+                } else {
+                    stack.push_back({child, static_cast<uint32_t>(depth), bound, ch});
+                }
+                return true;
+            });
+            if (typed) stack.push_back({typed, static_cast<uint32_t>(depth), bound, typedCh});
+        };
+        pushChildren(0, 0, rootBound);
+
+        size_t visited = 0;
+        while (!stack.empty() && visited < budget) {
+            Frame frame = stack.back();
+            stack.pop_back();
+            const TrieNode& n = nodeAt(frame.node);
+            size_t depth = frame.depth;
+            int best = frame.bound, low = 0;
+            for (size_t i = 0; i <= n.labelLength && low < frame.bound; i++, depth++, visited++) {
+                unsigned char ch = i == 0 ? frame.ch : static_cast<unsigned char>(arena.labels[n.labelOffset + i - 1]);
+                rows.resize((depth + 2) * width);
+                const int* above = &rows[depth * width];
+                int* row = &rows[(depth + 1) * width];
+                row[0] = above[0] + 1;
+                low = row[0];
+                for (size_t j = 1; j <= m; j++) {
+                    int substitute = above[j - 1] + (static_cast<unsigned char>(lowerPrefix[j - 1]) != ch);
+                    row[j] = min(min(above[j], row[j - 1]) + 1, substitute);
+                    low = min(low, row[j]);
+                }
+                best = min(best, row[m]);
+            }
+            // Completions of a node already under an equally close match add nothing, and
+            // descendants are only worth visiting while they could come closer still
+            if (best < frame.bound) matches.push_back({best, frame.node});
+            if (low < best && n.childCount) pushChildren(frame.node, depth, best);
+        }
+
+        // Matches give up their completions a distance at a time, best first, until limit
+        // words are found. That work counts against the budget too, past the first words.
+        sort(matches.begin(), matches.end());
+        const size_t count = static_cast<size_t>(limit);
+        vector<string> results;
+        unordered_set<uint32_t> seen; // words already given by a closer match
+        vector<uint32_t> ids;
+        auto affordable = [&]() { return visited < budget || results.empty(); };
+        for (size_t first = 0, last; first < matches.size() && results.size() < count && affordable(); first = last) {
+            for (last = first; last < matches.size() && matches[last].first == matches[first].first; last++) {}
+            size_t need = count - results.size();
+            ids.clear();
+            if (topK > 0) {
+                // Matches of one distance are disjoint subtrees, so one ranked walk covers them
+                vector<RankedCursor::Entry> heap;
+                for (size_t i = first; i < last && affordable(); i++, visited++) {
+                    rankedRead(heap, matches[i].second, 0, NO_NODE);
+                }
+                while (!heap.empty() && ids.size() < need && affordable()) {
+                    uint32_t id = rankedPop(heap);
+                    visited++;
+                    if (seen.insert(id).second) ids.push_back(id);
+                }
+            } else {
+                for (size_t i = first; i < last && affordable(); i++) {
+                    size_t before = ids.size();
+                    completionIds(matches[i].second, need + seen.size(), ids);
+                    visited += ids.size() - before + 1;
+                }
+                ids.erase(remove_if(ids.begin(), ids.end(), [&](uint32_t id) { return !seen.insert(id).second; }),
+                          ids.end());
+                size_t kept = min(need, ids.size());
+                partial_sort(ids.begin(), ids.begin() + kept, ids.end(),
+                             [&](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+                ids.resize(kept);
+            }
+            for (uint32_t id : ids) results.push_back(word(id));
+        }
+        return results;
+    }
+
+    // Returns a cursor over every completion of prefix, in alphabetical order
+    TrieCursor complete(const string& prefix) const {
+        string lowerPrefix = foldKey(prefix);
+        TrieCursor cursor;
+        uint32_t node = findPrefix(lowerPrefix);
+        if (node != NO_NODE) cursor.stack.push_back({node, 0});
+        return cursor;
+    }
+
+    // Appends up to count further completions from cursor to results, returning how
+    // many were added. Fewer than count means the cursor is exhausted.
+    size_t next(TrieCursor& cursor, vector<string>& results, size_t count) const {
+        size_t added = 0;
+        if (added < count && !cursor.stack.empty() && cursor.stack.back().position == 0) {
+            // Only the starting node is pushed before its word is emitted
+            TrieCursor::Frame& frame = cursor.stack.back();
+            frame.position = 1;
+            const TrieNode& n = nodeAt(frame.node);
+            if (n.isEndOfWord) {
+                results.push_back(word(n.wordId));
+                added++;
+            }
+        }
+        while (added < count && !cursor.stack.empty()) {
+            TrieCursor::Frame& frame = cursor.stack.back();
+            uint32_t position = frame.position - 1;
+            uint32_t child = childFrom(frame.node, position);
+            if (!child) {
+                cursor.stack.pop_back();
+                continue;
+            }
+            frame.position = position + 2;
+
+            // Emit the child's word on the way down; leaves need no frame of their own
+            const TrieNode& c = nodeAt(child);
+            if (c.isEndOfWord) {
+                results.push_back(word(c.wordId));
+                added++;
+            }
+            if (c.childCount) cursor.stack.push_back({child, 1});
+        }
+        // Drop finished frames so done() is accurate once the last word has been returned
+        while (!cursor.stack.empty()) {
+            TrieCursor::Frame& frame = cursor.stack.back();
+            uint32_t position = frame.position == 0 ? 0 : frame.position - 1;
+            if (frame.position == 0 || childFrom(frame.node, position)) break;
+            cursor.stack.pop_back();
+        }
+        return added;
+    }
+
+    // Writes the trie to an index file compiled from a word list with the given
+    // modification time and size. Returns false if the file could not be written.
+    bool writeIndex(const string& path, int64_t sourceMtime, int64_t sourceSize) const {
+        IndexHeader header = {};
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.formatVersion = INDEX_FORMAT_VERSION;
+        header.byteOrder = INDEX_BYTE_ORDER;
+        header.flags = (pathCompression ? INDEX_PATH_COMPRESSION : 0) | (scored ? INDEX_SCORED : 0) |
+                       (stripAccents ? INDEX_ACCENTS_STRIPPED : 0);
+        header.topK = static_cast<uint32_t>(topK);
+        header.sourceMtime = sourceMtime;
+        header.sourceSize = sourceSize;
+
+        string payload;
+        size_t n = 0;
+        auto append = [&](const void* data, size_t count, size_t elementSize) {
+            header.counts[n++] = count;
+            payload.append(static_cast<const char*>(data), count * elementSize);
+            payload.append((8 - payload.size() % 8) % 8, '\0');
+        };
+        append(arena.nodes.data(), arena.nodes.size(), sizeof(TrieNode));
+        append(arena.childKeys.data(), arena.childKeys.size(), 1);
+        append(arena.childNodes.data(), arena.childNodes.size(), sizeof(uint32_t));
+        append(arena.labels.data(), arena.labels.size(), 1);
+        append(wordPool.data(), wordPool.size(), 1);
+        append(words.data(), words.size(), sizeof(WordRef));
+        append(wordScores.data(), wordScores.size(), sizeof(uint32_t));
+        append(topStart.data(), topStart.size(), sizeof(uint32_t));
+        append(topIds.data(), topIds.size(), sizeof(uint32_t));
+        header.checksum = fnv1a(FNV_OFFSET_BASIS, payload.data(), payload.size());
+
+        // Write beside the target and rename, so readers never see a partial file
+        string tmpPath = path + ".tmp";
+        ofstream file(tmpPath, ios::binary | ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(payload.data(), payload.size());
+        file.close();
+        if (!file) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        remove(path.c_str()); // rename() does not replace an existing file on Windows
+        return rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+
+    // Replaces the trie with a view of an index file; false (and empty) if stale or malformed
+    bool mapIndex(const string& path, int64_t sourceMtime, int64_t sourceSize, bool verifyChecksum = false) {
+        *this = Trie(pathCompression);
+        shared_ptr<MappedFile> file = make_shared<MappedFile>();
+        if (!file->open(path) || file->size() < sizeof(IndexHeader)) return false;
+        IndexHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+            header.formatVersion != INDEX_FORMAT_VERSION || header.byteOrder != INDEX_BYTE_ORDER ||
+            header.sourceMtime != sourceMtime || header.sourceSize != sourceSize ||
+            ((header.flags & INDEX_ACCENTS_STRIPPED) != 0) != stripAccents) {
+            return false;
+        }
+
+        const char* payload = file->data() + sizeof(header);
+        size_t payloadSize = file->size() - sizeof(header);
+        if (verifyChecksum && fnv1a(FNV_OFFSET_BASIS, payload, payloadSize) != header.checksum) return false;
+        size_t offset = 0, n = 0;
+        bool ok = true;
+        auto attach = [&](auto& target, size_t elementSize) {
+            using Element = typename remove_reference<decltype(target[0])>::type;
+            size_t count = header.counts[n++];
+            if (!ok || count > payloadSize / elementSize || offset + count * elementSize > payloadSize) {
+                ok = false;
+                return;
+            }
+            target.attach(reinterpret_cast<const Element*>(payload + offset), count);
+            size_t bytes = count * elementSize;
+            offset += bytes + (8 - bytes % 8) % 8;
+        };
+        attach(arena.nodes, sizeof(TrieNode));
+        attach(arena.childKeys, 1);
+        attach(arena.childNodes, sizeof(uint32_t));
+        attach(arena.labels, 1);
+        attach(wordPool, 1);
+        attach(words, sizeof(WordRef));
+        attach(wordScores, sizeof(uint32_t));
+        attach(topStart, sizeof(uint32_t));
+        attach(topIds, sizeof(uint32_t));
+        if (!ok || arena.nodes.empty() || wordScores.size() != words.size() || arena.childKeys.size() != arena.childNodes.size() ||
+            (header.topK && topStart.size() != arena.nodes.size() + 1)) {
+            *this = Trie(pathCompression);
+            return false;
+        }
+        pathCompression = (header.flags & INDEX_PATH_COMPRESSION) != 0;
+        scored = (header.flags & INDEX_SCORED) != 0;
+        topK = header.topK;
+        mapping = file;
+        return true;
+    }
+
+    // Serializes a cursor's stack as "node-position" hex pairs joined by '.'
+    string saveCursor(const TrieCursor& cursor) const {
+        stringstream ss;
+        ss << hex;
+        for (size_t i = 0; i < cursor.stack.size(); i++) {
+            if (i) ss << '.';
+            ss << cursor.stack[i].node << '-' << cursor.stack[i].position;
+        }
+        return ss.str();
+    }
+
+    // Rebuilds a cursor saved by saveCursor. Returns false if the text is malformed,
+    // was saved for another prefix or names nodes this Trie does not have.
+    bool restoreCursor(const string& prefix, const string& saved, TrieCursor& cursor) const {
+        cursor.stack.clear();
+        stringstream ss(saved);
+        string frame;
+        while (getline(ss, frame, '.')) {
+            unsigned long node, position;
+            if (sscanf(frame.c_str(), "%lx-%lx", &node, &position) != 2) return false;
+            if (node >= arena.nodes.size() || position > 257) return false;
+            cursor.stack.push_back({static_cast<uint32_t>(node), static_cast<uint32_t>(position)});
+        }
+        return !cursor.stack.empty() && cursor.stack[0].node == findPrefix(foldKey(prefix));
+    }
+
+    size_t nodeCount() const {
+        return arena.nodes.size();
+    }
+
+    size_t wordCount() const {
+        return words.size();
+    }
+
+    // The word with ID id, in its original casing
+    string wordAt(uint32_t id) const {
+        return word(id);
+    }
+
+    // The best limit of the given words, in suggestion order
+    vector<string> bestOf(vector<uint32_t> ids, int limit) const {
+        size_t count = min(ids.size(), static_cast<size_t>(max(limit, 0)));
+        partial_sort(ids.begin(), ids.begin() + count, ids.end(),
+                     [&](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+        vector<string> results;
+        for (size_t i = 0; i < count; i++) results.push_back(word(ids[i]));
+        return results;
+    }
+
+    // Approximate footprint in bytes (heap plus any mapped index), used for the index
+    // cache's memory budget
+    size_t memoryUsage() const {
+        return arena.memoryUsage() + wordPool.capacity() + words.capacity() * sizeof(WordRef)
+             + wordScores.capacity() * sizeof(uint32_t)
+             + (topStart.capacity() + topIds.capacity()) * sizeof(uint32_t)
+             + (mapping ? mapping->size() : 0);
+    }
+};
+
+// --- FST BACKEND ---
+// Minimal acyclic automaton over the lowercase words, much smaller than a Trie for very
+// large lists but without scores. Insert every word, then freeze() once before suggesting.
+class FstIndex {
+    static const uint32_t FINAL_STATE = 0x80000000u; // flag in stateWords
+
+    // State s owns transitions [stateFirst[s], stateFirst[s + 1]), sorted by label
+    vector<uint32_t> stateFirst = {0};
+    vector<uint32_t> stateWords; // words accepted from the state, | FINAL_STATE
+    vector<unsigned char> labels;
+    vector<uint32_t> targets;
+    uint32_t root = 0;
+
+    // Words whose original casing differs from their lowercase form, by rank
+    vector<uint32_t> casedRanks;
+    vector<pair<uint32_t, uint32_t>> casedRefs; // offset and length in casedPool
+    string casedPool;
+
+    vector<string> pending; // inserted words, consumed by freeze()
+
+    // A state on the path of the last word added, not yet merged into the automaton.
+    // Its last transition leads to the next state on the path until that is frozen.
+    struct OpenState {
+        vector<pair<unsigned char, uint32_t>> edges;
+        bool final = false;
+    };
+
+    uint32_t words(uint32_t state) const {
+        return stateWords[state] & ~FINAL_STATE;
+    }
+
+    // Returns the existing state equal to s, or appends s as a new one
+    uint32_t freezeState(const OpenState& s, unordered_map<string, uint32_t>& registry) {
+        string signature(1, s.final ? '\1' : '\0');
+        for (const auto& edge : s.edges) {
+            signature += static_cast<char>(edge.first);
+            signature.append(reinterpret_cast<const char*>(&edge.second), sizeof(edge.second));
+        }
+        auto found = registry.find(signature);
+        if (found != registry.end()) return found->second;
+
+        uint32_t count = s.final ? 1 : 0;
+        for (const auto& edge : s.edges) {
+            labels.push_back(edge.first);
+            targets.push_back(edge.second);
+            count += words(edge.second);
+        }
+        uint32_t id = static_cast<uint32_t>(stateWords.size());
+        stateWords.push_back(count | (s.final ? FINAL_STATE : 0));
+        stateFirst.push_back(static_cast<uint32_t>(labels.size()));
+        registry.emplace(move(signature), id);
+        return id;
+    }
+
+    // Follows the transition on ch from state, or returns false
+    bool step(uint32_t& state, unsigned char ch, uint32_t& rank) const {
+        if (stateWords[state] & FINAL_STATE) rank++; // the word ending here sorts first
+        for (uint32_t t = stateFirst[state]; t < stateFirst[state + 1]; t++) {
+            if (labels[t] == ch) {
+                state = targets[t];
+                return true;
+            }
+            if (labels[t] > ch) break;
+            rank += words(targets[t]);
+        }
+        return false;
+    }
+
+    string original(uint32_t rank, const string& lower) const {
+        auto it = lower_bound(casedRanks.begin(), casedRanks.end(), rank);
+        if (it == casedRanks.end() || *it != rank) return lower;
+        const auto& ref = casedRefs[it - casedRanks.begin()];
+        return casedPool.substr(ref.first, ref.second);
+    }
+
+public:
+    void insert(const string& word) {
+        if (!word.empty()) pending.push_back(word);
+    }
+
+    // Builds the automaton from the inserted words. A repeated word keeps its first casing.
+    void freeze() {
+        vector<string> keys(pending.size());
+        vector<uint32_t> order(pending.size());
+        for (size_t i = 0; i < pending.size(); i++) {
+            keys[i] = foldKey(pending[i]);
+            order[i] = static_cast<uint32_t>(i);
+        }
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return keys[a] < keys[b];
+        });
+
+        stateFirst = {0};
+        stateWords.clear();
+        labels.clear();
+        targets.clear();
+        casedRanks.clear();
+        casedRefs.clear();
+        casedPool.clear();
+
+        // States past the common prefix with the previous word are final and get merged
+        unordered_map<string, uint32_t> registry;
+        vector<OpenState> path(1);
+        const string* previous = nullptr;
+        uint32_t rank = 0;
+        for (uint32_t i : order) {
+            const string& key = keys[i];
+            if (previous && key == *previous) continue;
+            size_t common = 0;
+            if (previous) {
+                while (common < key.size() && common < previous->size() && key[common] == (*previous)[common]) common++;
+                for (size_t d = previous->size(); d > common; d--) {
+                    path[d - 1].edges.back().second = freezeState(path[d], registry);
+                }
+            }
+            path.resize(common + 1);
+            for (size_t d = common; d < key.size(); d++) {
+                path[d].edges.push_back({static_cast<unsigned char>(key[d]), 0});
+                path.emplace_back();
+            }
+            path.back().final = true;
+
+            if (pending[i] != key) {
+                casedRanks.push_back(rank);
+                casedRefs.push_back({static_cast<uint32_t>(casedPool.size()), static_cast<uint32_t>(pending[i].size())});
+                casedPool += pending[i];
+            }
+            rank++;
+            previous = &key;
+        }
+        for (size_t d = path.size() - 1; d > 0; d--) {
+            path[d - 1].edges.back().second = freezeState(path[d], registry);
+        }
+        root = freezeState(path[0], registry);
+
+        vector<string>().swap(pending);
+        stateFirst.shrink_to_fit();
+        stateWords.shrink_to_fit();
+        labels.shrink_to_fit();
+        targets.shrink_to_fit();
+    }
+
+    // Returns up to limit completions of prefix in alphabetical order, after the first skip
+    vector<string> suggest(const string& prefix, int limit, size_t skip = 0) const {
+        vector<string> results;
+        if (stateWords.empty() || limit <= 0) return results;
+        string buffer = foldKey(prefix);
+
+        uint32_t state = root, rank = 0;
+        for (unsigned char ch : buffer) {
+            if (!step(state, ch, rank)) return results;
+        }
+        if (skip >= words(state)) return results;
+
+        // Depth-first in label order; subtrees wholly inside the skipped range are passed over
+        vector<pair<uint32_t, uint32_t>> stack; // state and its next transition
+        auto enter = [&](uint32_t s) {
+            if (stateWords[s] & FINAL_STATE) {
+                if (skip > 0) skip--;
+                else results.push_back(original(rank, buffer));
+                rank++;
+            }
+            stack.push_back({s, stateFirst[s]});
+        };
+        enter(state);
+        while (!stack.empty() && results.size() < static_cast<size_t>(limit)) {
+            auto& top = stack.back();
+            if (top.second == stateFirst[top.first + 1]) {
+                stack.pop_back();
+                if (!stack.empty()) buffer.pop_back();
+                continue;
+            }
+            uint32_t t = top.second++;
+            uint32_t target = targets[t];
+            if (skip >= words(target)) {
+                skip -= words(target);
+                rank += words(target);
+                continue;
+            }
+            buffer += static_cast<char>(labels[t]);
+            enter(target);
+        }
+        return results;
+    }
+
+    size_t size() const {
+        return stateWords.empty() ? 0 : words(root);
+    }
+
+    size_t stateCount() const {
+        return stateWords.size();
+    }
+
+    size_t memoryUsage() const {
+        return (stateFirst.capacity() + stateWords.capacity() + targets.capacity() + casedRanks.capacity()) * sizeof(uint32_t)
+             + labels.capacity() + casedRefs.capacity() * sizeof(casedRefs[0]) + casedPool.capacity();
+    }
+};
+
+// --- SUBSTRING INDEX ---
+// Suffix array over a Trie's words, for fragments anywhere in a word (infix=1)
+#ifndef INFIX_SCAN_LIMIT
+#define INFIX_SCAN_LIMIT 200000 // suffixes a query may read; longer runs are cut short
+#endif
+
+class SubstringIndex {
+    string text;                  // lowercased words, each followed by a NUL
+    vector<uint32_t> suffixes;    // offsets of every word character, sorted by suffix
+    vector<uint32_t> suffixWords; // word ID of each suffix, so a run is read without text
+    vector<uint8_t> lcp;          // lcp[i]: common prefix of suffixes i - 1 and i, capped at 255
+
+    // Shared prefix length of the suffixes at a and b (they stop at the NUL)
+    static size_t commonPrefix(const char* a, const char* b) {
+        size_t n = 0;
+        while (a[n] && a[n] == b[n]) n++;
+        return n;
+    }
+
+public:
+    void build(const Trie& trie, unsigned threads = 1) {
+        size_t count = trie.wordCount();
+        vector<uint32_t> starts(count); // offset of each word in text
+        for (uint32_t id = 0; id < count; id++) {
+            starts[id] = static_cast<uint32_t>(text.size());
+            string word = trie.wordAt(id);
+            foldKey(word.data(), word.size(), text);
+            text.push_back('\0');
+        }
+        suffixes.reserve(text.size() - count);
+        for (uint32_t i = 0; i < text.size(); i++) {
+            if (text[i]) suffixes.push_back(i);
+        }
+        const char* base = text.data();
+        parallelSort(suffixes.begin(), suffixes.end(), [base](uint32_t a, uint32_t b) {
+            int order = strcmp(base + a, base + b);
+            return order != 0 ? order < 0 : a < b;
+        }, threads);
+        lcp.assign(suffixes.size(), 0);
+        suffixWords.resize(suffixes.size());
+        for (size_t i = 0; i < suffixes.size(); i++) {
+            if (i > 0) lcp[i] = static_cast<uint8_t>(min<size_t>(commonPrefix(base + suffixes[i - 1], base + suffixes[i]), 255));
+            suffixWords[i] = static_cast<uint32_t>(upper_bound(starts.begin(), starts.end(), suffixes[i]) - starts.begin() - 1);
+        }
+    }
+
+    // Appends the IDs of words containing lowerFragment to ids, each once (ascending)
+    void matches(const string& lowerFragment, vector<uint32_t>& ids, size_t scanLimit = INFIX_SCAN_LIMIT) const {
+        const char* base = text.data();
+        const char* query = lowerFragment.c_str();
+        size_t m = lowerFragment.size();
+        if (m == 0 || memchr(query, '\0', m)) return;
+
+        // First suffix >= the fragment. Every suffix between the bounds shares
+        // min(lowShared, highShared) characters with it, so comparisons start there.
+        size_t low = 0, high = suffixes.size(), lowShared = 0, highShared = 0;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            const char* suffix = base + suffixes[mid];
+            size_t k = min(lowShared, highShared);
+            while (k < m && suffix[k] == query[k]) k++;
+            if (k < m && static_cast<unsigned char>(suffix[k]) < static_cast<unsigned char>(query[k])) {
+                low = mid + 1;
+                lowShared = k;
+            } else {
+                high = mid;
+                highShared = k;
+            }
+        }
+        if (low == suffixes.size() || strncmp(base + suffixes[low], query, m) != 0) return;
+
+        size_t first = ids.size();
+        for (size_t i = low; i < suffixes.size() && i - low < scanLimit; i++) {
+            if (i > low && lcp[i] < min<size_t>(m, 255)) break;
+            if (i > low && m > 255 && strncmp(base + suffixes[i], query, m) != 0) break;
+            ids.push_back(suffixWords[i]);
+        }
+        // A word holding the fragment more than once has one suffix per occurrence
+        sort(ids.begin() + first, ids.end());
+        ids.erase(unique(ids.begin() + first, ids.end()), ids.end());
+    }
+
+    size_t suffixCount() const {
+        return suffixes.size();
+    }
+
+    size_t memoryUsage() const {
+        return text.capacity() + (suffixes.capacity() + suffixWords.capacity()) * sizeof(uint32_t) + lcp.capacity();
+    }
+};
+
+
+// --- TOKEN INDEX ---
+// Posting lists of the tokens in each line, so "york ci" finds "New York City" (tokens=1)
+#ifndef TOKEN_SCAN_LIMIT
+#define TOKEN_SCAN_LIMIT 200000 // postings a prefix may read; larger slices are cut short
+#endif
+
+class TokenIndex {
+    string text;                    // every line, lowercased
+    vector<uint32_t> lineStarts;    // line i is text[lineStarts[i] .. lineStarts[i + 1])
+    string tokenPool;
+    vector<uint32_t> tokenStarts;   // token i is tokenPool[tokenStarts[i] .. tokenStarts[i + 1])
+    vector<uint32_t> postingStarts; // token i's lines are postings[postingStarts[i] .. postingStarts[i + 1])
+    vector<uint32_t> postings;
+
+    static bool isTokenByte(unsigned char ch) {
+        return isalnum(ch) || ch >= 0x80;
+    }
+
+    string_view token(size_t i) const {
+        return string_view(tokenPool.data() + tokenStarts[i], tokenStarts[i + 1] - tokenStarts[i]);
+    }
+
+    // Range [first, last) of the tokens starting with prefix (or equal to it if whole)
+    pair<size_t, size_t> tokenRange(string_view prefix, bool whole) const {
+        size_t count = tokenCount();
+        auto search = [&](bool past) {
+            size_t low = 0, high = count;
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+                string_view t = token(mid);
+                bool before = past ? (whole ? t <= prefix : t.substr(0, prefix.size()) <= prefix) : t < prefix;
+                if (before) low = mid + 1; else high = mid;
+            }
+            return low;
+        };
+        return {search(false), search(true)};
+    }
+
+    // Whether line id has a token starting with prefix
+    bool lineHasPrefix(uint32_t id, string_view prefix) const {
+        string_view line(text.data() + lineStarts[id], lineStarts[id + 1] - lineStarts[id]);
+        for (string_view t : tokenize(line)) {
+            if (t.substr(0, prefix.size()) == prefix) return true;
+        }
+        return false;
+    }
+
+    // Keeps the IDs of ids (ascending) that also appear in [first, last), galloping through it
+    static void intersect(vector<uint32_t>& ids, const uint32_t* first, const uint32_t* last) {
+        size_t kept = 0;
+        for (uint32_t id : ids) {
+            size_t bound = 1;
+            while (first + bound < last && first[bound] < id) bound *= 2;
+            first = lower_bound(first + bound / 2, min(first + bound + 1, last), id);
+            if (first == last) break;
+            if (*first == id) ids[kept++] = id;
+        }
+        ids.resize(kept);
+    }
+
+public:
+    // Splits lowercased text into tokens
+    static vector<string_view> tokenize(string_view text) {
+        vector<string_view> tokens;
+        size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && !isTokenByte(text[i])) i++;
+            size_t start = i;
+            while (i < text.size() && isTokenByte(text[i])) i++;
+            if (i > start) tokens.push_back(text.substr(start, i - start));
+        }
+        return tokens;
+    }
+
+    void build(const Trie& trie, unsigned threads = 1) {
+        size_t count = trie.wordCount();
+        text.clear();
+        lineStarts.assign(count + 1, 0);
+        for (uint32_t id = 0; id < count; id++) {
+            lineStarts[id] = static_cast<uint32_t>(text.size());
+            string line = trie.wordAt(id);
+            foldKey(line.data(), line.size(), text);
+        }
+        lineStarts[count] = static_cast<uint32_t>(text.size());
+
+        vector<pair<string_view, uint32_t>> occurrences; // token and line ID
+        for (uint32_t id = 0; id < count; id++) {
+            string_view line(text.data() + lineStarts[id], lineStarts[id + 1] - lineStarts[id]);
+            for (string_view t : tokenize(line)) occurrences.push_back({t, id});
+        }
+        parallelSort(occurrences.begin(), occurrences.end(), less<pair<string_view, uint32_t>>(), threads);
+        occurrences.erase(unique(occurrences.begin(), occurrences.end()), occurrences.end());
+
+        tokenPool.clear();
+        tokenStarts.clear();
+        postingStarts.clear();
+        postings.clear();
+        postings.reserve(occurrences.size());
+        for (size_t i = 0; i < occurrences.size(); i++) {
+            if (i == 0 || occurrences[i].first != occurrences[i - 1].first) {
+                tokenStarts.push_back(static_cast<uint32_t>(tokenPool.size()));
+                postingStarts.push_back(static_cast<uint32_t>(postings.size()));
+                tokenPool.append(occurrences[i].first.data(), occurrences[i].first.size());
+            }
+            postings.push_back(occurrences[i].second);
+        }
+        tokenStarts.push_back(static_cast<uint32_t>(tokenPool.size()));
+        postingStarts.push_back(static_cast<uint32_t>(postings.size()));
+    }
+
+    // Appends the IDs (ascending) of the lines matching every token of query to ids
+    void matches(const string& query, vector<uint32_t>& ids, size_t scanLimit = TOKEN_SCAN_LIMIT) const {
+        string lowerQuery = foldKey(query);
+        vector<string_view> terms = tokenize(lowerQuery);
+        if (terms.empty() || tokenStarts.size() < 2) return;
+        bool lastIsPrefix = isTokenByte(lowerQuery.back());
+
+        // Each whole term's lines are one slice of postings, in ascending order
+        typedef pair<const uint32_t*, const uint32_t*> Slice;
+        auto shorter = [](const Slice& a, const Slice& b) { return a.second - a.first < b.second - b.first; };
+        vector<Slice> lists;
+        for (size_t t = 0; t + (lastIsPrefix ? 1 : 0) < terms.size(); t++) {
+            pair<size_t, size_t> range = tokenRange(terms[t], true);
+            if (range.first == range.second) return;
+            lists.push_back({postings.data() + postingStarts[range.first], postings.data() + postingStarts[range.second]});
+        }
+        sort(lists.begin(), lists.end(), shorter);
+
+        // Merge the lists of the tokens the prefix completes, unless the whole terms leave fewer lines
+        vector<uint32_t> merged;
+        bool checkPrefix = false;
+        if (lastIsPrefix) {
+            pair<size_t, size_t> range = tokenRange(terms.back(), false);
+            if (range.first == range.second) return;
+            Slice slice(postings.data() + postingStarts[range.first], postings.data() + postingStarts[range.second]);
+            if (range.second - range.first == 1) {
+                lists.push_back(slice);
+            } else if (!lists.empty() && size_t(lists[0].second - lists[0].first) * 8 < size_t(slice.second - slice.first)) {
+                checkPrefix = true;
+            } else {
+                merged.assign(slice.first, slice.first + min<size_t>(slice.second - slice.first, scanLimit));
+                sort(merged.begin(), merged.end());
+                merged.erase(unique(merged.begin(), merged.end()), merged.end());
+                lists.push_back({merged.data(), merged.data() + merged.size()});
+            }
+            sort(lists.begin(), lists.end(), shorter);
+        }
+
+        vector<uint32_t> found(lists[0].first, lists[0].second);
+        for (size_t i = 1; i < lists.size() && !found.empty(); i++) {
+            intersect(found, lists[i].first, lists[i].second);
+        }
+        for (uint32_t id : found) {
+            if (!checkPrefix || lineHasPrefix(id, terms.back())) ids.push_back(id);
+        }
+    }
+
+    size_t tokenCount() const {
+        return tokenStarts.empty() ? 0 : tokenStarts.size() - 1;
+    }
+
+    size_t memoryUsage() const {
+        return text.capacity() + tokenPool.capacity()
+             + (lineStarts.capacity() + tokenStarts.capacity() + postingStarts.capacity() + postings.capacity()) * sizeof(uint32_t);
+    }
+};
+
+
+// --- UTILITY FUNCTIONS ---
+string trim(const string &s) {
+    size_t start = s.find_first_not_of(" \t\n\r");
+    if (string::npos == start) return "";
+    size_t end = s.find_last_not_of(" \t\n\r");
+    return s.substr(start, end - start + 1);
+}
+
+string urlDecode(const string &SRC) {
+    string ret;
+    char ch;
+    int i, ii;
+    for (i = 0; i < SRC.length(); i++) {
+        if (SRC[i] == '+') {
+            ret += ' ';
+        } else if (int(SRC[i]) == 37) {
+            sscanf(SRC.substr(i + 1, 2).c_str(), "%x", &ii);
+            ch = static_cast<char>(ii);
+            ret += ch;
+            i = i + 2;
+        } else {
+            ret += SRC[i];
+        }
+    }
+    return ret;
+}
+
+string json_escape(const string &s) {
+    stringstream o;
+    for (auto c = s.cbegin(); c != s.cend(); c++) {
+        switch (*c) {
+            case '"': o << "\\\""; break;
+            case '\\': o << "\\\\"; break;
+            case '\b': o << "\\b"; break;
+            case '\f': o << "\\f"; break;
+            case '\n': o << "\\n"; break;
+            case '\r': o << "\\r"; break;
+            case '\t': o << "\\t"; break;
+            default:
+                if ('\x00' <= *c && *c <= '\x1f') {
+                    o << "\\u" << hex << setfill('0') << setw(4) << static_cast<int>(*c);
+                } else {
+                    o << *c;
+                }
+        }
+    }
+    return o.str();
+}
+
+//extracts a specific piece of information from a URL's query string
+string getQueryParam(const string &query, const string &key) {
+    size_t pos = query.find(key + "=");
+    if (pos == string::npos) return "";
+    size_t start = pos + key.length() + 1;
+    size_t end = query.find("&", start);
+    return urlDecode(query.substr(start, end == string::npos ? string::npos : end - start));
+}
+
+// Parses a row id sent by the client; false unless text is a plain positive integer
+bool parseRowId(const string& text, int& id) {
+    if (text.empty() || text.size() > 9 || !all_of(text.begin(), text.end(), [](unsigned char c) { return isdigit(c); })) {
+        return false;
+    }
+    id = stoi(text);
+    return true;
+}
+
+string join(const vector<string>& vec, const string& delim) {
+    stringstream ss;
+    for (size_t i = 0; i < vec.size(); ++i) {
+        ss << vec[i];
+        if (i < vec.size() - 1) ss << delim;
+    }
+    return ss.str();
+}
+
+// Calls f(word, length, score) for every trimmed, non-blank line; "word\t42" has score 42, others 0
+template <typename F>
+void scanWords(const char* text, size_t size, F f) {
+    auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+    const char* p = text;
+    const char* end = p + size;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char* first = p;
+        const char* last = eol;
+        while (first < last && blank(*first)) first++;
+        while (last > first && blank(last[-1])) last--;
+
+        uint32_t score = 0;
+        const char* digits = last;
+        while (digits > first && isdigit(static_cast<unsigned char>(digits[-1]))) digits--;
+        const char* gap = digits;
+        while (gap > first && (gap[-1] == ' ' || gap[-1] == '\t')) gap--;
+        if (digits < last && gap > first && memchr(gap, '\t', digits - gap)) {
+            uint64_t count = 0;
+            for (const char* d = digits; d < last; d++) count = min<uint64_t>(count * 10 + (*d - '0'), UINT32_MAX);
+            score = static_cast<uint32_t>(count);
+            last = gap;
+        }
+        if (first < last) f(first, static_cast<size_t>(last - first), score);
+        p = eol + 1;
+    }
+}
+
+// scanWords over the mapped file at filename. Returns false if the file can't be opened
+// (an empty file just has no lines).
+template <typename F>
+bool forEachWord(const string& filename, F f) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        struct stat info;
+        return stat(filename.c_str(), &info) == 0 && info.st_size == 0;
+    }
+    scanWords(file.data(), file.size(), f);
+    return true;
+}
+
+// --- PARALLEL BUILD ---
+// bulkLoad and the substring and token indexes build large lists on several threads
+unsigned buildThreads = 0; // set with --build-threads; 0 = one per core
+
+unsigned buildThreadCount() {
+    return buildThreads ? buildThreads : max(1u, thread::hardware_concurrency());
+}
+
+// (NEW) Helper function to load words from a file into the Trie.
+// searchCounts (lowercase word -> times searched) is added to the words' scores.
+void loadWordsIntoTrie(const string& filename, Trie& trie, const map<string, uint32_t>& searchCounts = {}) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0 || info.st_size != 0) {
+            return; // Silently fail if file can't be opened
+        }
+    } else {
+        vector<WordSpan> spans;
+        scanWords(file.data(), file.size(), [&](const char* word, size_t length, uint32_t score) {
+            spans.push_back({word, length, score});
+        });
+        trie.bulkLoad(spans, buildThreadCount());
+    }
+    for (const auto& count : searchCounts) trie.addScore(count.first, count.second);
+    trie.buildTopCompletions(TRIE_TOP_K);
+}
+
+// Loads words from a file into an FstIndex and freezes it
+void loadWordsIntoFst(const string& filename, FstIndex& fst) {
+    bool opened = forEachWord(filename, [&](const char* word, size_t length, uint32_t) {
+        fst.insert(string(word, length));
+    });
+    if (!opened) {
+        return;
+    }
+    fst.freeze();
+}
+
+// --- RESIDENT STATE ---
+// The database connection, prepared statements and built indexes live as long as the process
+const string DB_PATH = "../sqlite/users.db";
+
+sqlite3* residentDb = nullptr;
+map<string, sqlite3_stmt*> residentStatements;
+
+size_t indexCacheBudget = 256 * 1024 * 1024; // bytes, set with --cache-mb
+off_t fstMinBytes = 0; // word lists at least this large are held as an FstIndex; set with --fst-min-mb (0 = never)
+
+// Word lists this large get no Trie or index file: the cache loads them into an FstIndex
+bool heldAsFst(const struct stat& info) {
+    return fstMinBytes > 0 && info.st_size >= fstMinBytes;
+}
+
+// Opens the users database once and returns the shared connection (nullptr on failure)
+sqlite3* getDatabase() {
+    if (!residentDb) {
+        if (sqlite3_open(DB_PATH.c_str(), &residentDb) != SQLITE_OK) {
+            sqlite3_close(residentDb);
+            residentDb = nullptr;
+            return nullptr;
+        }
+        // auth.cgi writes to the same file, so wait briefly instead of failing on a lock
+        sqlite3_busy_timeout(residentDb, 2000);
+    }
+    return residentDb;
+}
+
+// Returns a cached prepared statement for sql, ready to bind (nullptr on failure).
+// Callers sqlite3_reset() it when done instead of finalizing it.
+sqlite3_stmt* getStatement(sqlite3* db, const string& sql) {
+    if (!db) return nullptr;
+    auto it = residentStatements.find(sql);
+    if (it != residentStatements.end()) {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    residentStatements[sql] = stmt;
+    return stmt;
+}
+
+// --- INDEX FILES ---
+// Each upload is compiled once into <upload>.idx, recompiled when the list's mtime or size changes
+string indexPathFor(const string& path) {
+    return path + ".idx";
+}
+
+// Whether an upload by this name could be overwritten by another upload's index
+bool isIndexFileName(const string& name) {
+    for (const string suffix : {".idx", ".idx.tmp"}) {
+        if (name.size() >= suffix.size() &&
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) return true;
+    }
+    return false;
+}
+
+// How often each term was searched by the users who uploaded the list at path, added to its scores
+map<string, uint32_t> searchCounts(const string& path) {
+    map<string, uint32_t> counts;
+    sqlite3* db = getDatabase();
+    sqlite3_stmt* stmt = getStatement(db, "SELECT lower(search_term), COUNT(*) FROM search_history WHERE username IN "
+                                          "(SELECT username FROM uploads WHERE filename = ?) GROUP BY 1;");
+    if (!stmt) return counts;
+    string filename = path.substr(path.rfind('/') + 1);
+    sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* term = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (term) counts[foldKey(term)] += static_cast<uint32_t>(sqlite3_column_int(stmt, 1));
+    }
+    sqlite3_reset(stmt);
+    return counts;
+}
+
+// Builds a Trie from the word list at path and writes its index file
+shared_ptr<Trie> compileIndex(const string& path, const struct stat& info) {
+    shared_ptr<Trie> trie = make_shared<Trie>();
+    loadWordsIntoTrie(path, *trie, searchCounts(path));
+    trie->writeIndex(indexPathFor(path), info.st_mtime, info.st_size);
+    return trie;
+}
+
+// Adds the words of `text`, just appended to the list at path (stat `before` and `after`), to its index
+void appendToIndex(const string& path, const struct stat& before, const struct stat& after, const string& text) {
+    if (heldAsFst(after)) {
+        remove(indexPathFor(path).c_str()); // stale once the list grew past --fst-min-mb
+        return;
+    }
+    shared_ptr<Trie> trie = make_shared<Trie>();
+    // Checksummed here: the whole index is copied and rewritten anyway
+    if (!trie->mapIndex(indexPathFor(path), before.st_mtime, before.st_size, true)) {
+        compileIndex(path, after);
+        return;
+    }
+    map<string, uint32_t> counts = searchCounts(path);
+    vector<WordSpan> spans;
+    scanWords(text.data(), text.size(), [&](const char* word, size_t length, uint32_t score) {
+        string lowerWord;
+        foldKey(word, length, lowerWord);
+        auto searched = counts.find(lowerWord);
+        if (searched != counts.end()) score = static_cast<uint32_t>(min<uint64_t>(uint64_t(score) + searched->second, UINT32_MAX));
+        spans.push_back({word, length, score});
+    });
+    trie->append(spans);
+    trie->writeIndex(indexPathFor(path), after.st_mtime, after.st_size);
+}
+
+// Maps the Trie for the word list at path from its index, compiling it if needed
+shared_ptr<Trie> openIndex(const string& path, const struct stat& info) {
+    shared_ptr<Trie> trie = make_shared<Trie>();
+    if (trie->mapIndex(indexPathFor(path), info.st_mtime, info.st_size)) {
+        return trie;
+    }
+    return compileIndex(path, info);
+}
+
+
+// --- INDEX CACHE ---
+// Built indexes by file path, reused while mtime and size match and evicted LRU past the budget
+
+// The loaded form of one word list: a Trie, or an FstIndex for very large lists. A
+// Trie gains a SubstringIndex or TokenIndex the first time a query needs one.
+struct SuggestionIndex {
+    shared_ptr<Trie> trie;
+    shared_ptr<FstIndex> fst;
+    shared_ptr<SubstringIndex> infix;
+    shared_ptr<TokenIndex> tokens;
+};
 
-class Trie {
-    TrieNode* root;
- 
-    map<string, string> originalWords; 
+class IndexCache {
+    struct Entry {
+        string path;
+        time_t mtime;
+        off_t size;
+        SuggestionIndex index;
+        size_t bytes;
+    };
 
-    // Helper function to find all words from a given node
-    void dfs(TrieNode* node, string currentPrefix, vector<string>& results, int limit) {
-        if (results.size() >= limit) {
-            return;
+    list<Entry> entries; // most recently used first
+    unordered_map<string, list<Entry>::iterator> byPath;
+    size_t totalBytes = 0;
+
+    void evictOverBudget(size_t budget) {
+        // Never evict the entry that was just used, even if it alone exceeds the budget
+        while (totalBytes > budget && entries.size() > 1) {
+            totalBytes -= entries.back().bytes;
+            byPath.erase(entries.back().path);
+            entries.pop_back();
         }
-        if (node->isEndOfWord) {
-            // Use the map to retrieve the original word with its correct casing
-            if (originalWords.count(currentPrefix)) {
-                results.push_back(originalWords[currentPrefix]);
+    }
+
+public:
+    // Returns the index for path, rebuilding it if the file changed since it was cached
+    SuggestionIndex get(const string& path, size_t budget) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            erase(path);
+            SuggestionIndex empty;
+            empty.trie = make_shared<Trie>();
+            return empty;
+        }
+
+        auto it = byPath.find(path);
+        if (it != byPath.end()) {
+            if (it->second->mtime == info.st_mtime && it->second->size == info.st_size) {
+                entries.splice(entries.begin(), entries, it->second);
+                return entries.front().index;
             }
+            erase(path);
         }
-        for (const auto& pair : node->children) {
-    char key = pair.first;
-    TrieNode* val = pair.second;
-    dfs(val, currentPrefix + key, results, limit);
-    if (results.size() >= limit) {
-        return;
+
+        SuggestionIndex index;
+        if (heldAsFst(info)) {
+            index.fst = make_shared<FstIndex>();
+            loadWordsIntoFst(path, *index.fst);
+        } else {
+            index.trie = openIndex(path, info);
+        }
+        size_t bytes = index.trie ? index.trie->memoryUsage() : index.fst->memoryUsage();
+        entries.push_front({path, info.st_mtime, info.st_size, index, bytes});
+        byPath[path] = entries.begin();
+        totalBytes += bytes;
+        evictOverBudget(budget);
+        return index;
+    }
+
+    // Returns the secondary index (e.g. &SuggestionIndex::infix) of the Trie cached for
+    // path (by get), building it on first use. nullptr for lists without a Trie.
+    template <typename T>
+    shared_ptr<T> secondary(const string& path, size_t budget, shared_ptr<T> SuggestionIndex::*member) {
+        auto it = byPath.find(path);
+        if (it == byPath.end() || !it->second->index.trie) return nullptr;
+        Entry& entry = *it->second;
+        shared_ptr<T> built = entry.index.*member;
+        if (!built) {
+            built = make_shared<T>();
+            built->build(*entry.index.trie, buildThreadCount());
+            entry.index.*member = built;
+            entry.bytes += built->memoryUsage();
+            totalBytes += built->memoryUsage();
+            evictOverBudget(budget);
+        }
+        return built;
     }
+
+    void erase(const string& path) {
+        auto it = byPath.find(path);
+        if (it == byPath.end()) return;
+        totalBytes -= it->second->bytes;
+        entries.erase(it->second);
+        byPath.erase(it);
+    }
+};
+
+IndexCache indexCache;
+
+// Identifies the current contents of a file by modification time and size, in hex
+string fileVersion(const string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return "0";
+    stringstream ss;
+    ss << hex << static_cast<long long>(info.st_mtime) << '-' << static_cast<long long>(info.st_size);
+    return ss.str();
 }
+
+// --- PERSONALIZATION ---
+// A user's own searches boost those words, by counters in search_recency that halve every half-life
+#ifndef HISTORY_BOOST
+#define HISTORY_BOOST 100 // added to a word's score per (decayed) search of it
+#endif
+#ifndef RECENCY_HALF_LIFE_DAYS
+#define RECENCY_HALF_LIFE_DAYS 14
+#endif
+const double RECENCY_HALF_LIFE = RECENCY_HALF_LIFE_DAYS * 24.0 * 3600.0; // seconds
+const double RECENCY_MIN_SCORE = 1e-3; // counters decayed below this are dropped
+
+struct DecayedCounter {
+    double score = 0;   // value at `updated`
+    int64_t updated = 0; // unix time
+
+    double at(int64_t now) const {
+        return now <= updated ? score : score * exp2(double(updated - now) / RECENCY_HALF_LIFE);
     }
+    void add(double amount, int64_t now) {
+        score = at(now) + amount;
+        updated = max(updated, now);
+    }
+};
 
-public:
-    Trie() { 
-        root = new TrieNode(); 
+// One user's counters, sorted so the terms completing a query are one range
+struct UserRecency {
+    map<string, DecayedCounter> terms; // by lowercase term
+
+    DecayedCounter& counter(const string& term) {
+        return terms[term];
     }
+    void erase(const string& term) {
+        terms.erase(term);
+    }
+};
 
-    // Inserts a word into the trie
-    void insert(const string& word) {
-        if (word.empty()) return;
+class RecencyScores {
+    unordered_map<string, UserRecency> users;
+    bool tableReady = false;
 
-        string lowerWord = word;
-        transform(lowerWord.begin(), lowerWord.end(), lowerWord.begin(), ::tolower);
-        
-        // Store the original word if this lowercase version isn't already mapped
-        if (originalWords.find(lowerWord) == originalWords.end()) {
-            originalWords[lowerWord] = word;
+    bool ensureTable(sqlite3* db) {
+        if (!tableReady && db) {
+            tableReady = sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS search_recency ("
+                                          "username TEXT NOT NULL, term TEXT NOT NULL, "
+                                          "score REAL NOT NULL, updated INTEGER NOT NULL, "
+                                          "PRIMARY KEY(username, term));", nullptr, nullptr, nullptr) == SQLITE_OK;
         }
+        return tableReady;
+    }
 
-        TrieNode* node = root;
-        for (char ch : lowerWord) {
-            if (node->children.find(ch) == node->children.end()) {
-                node->children[ch] = new TrieNode();
+    void store(const string& user, const string& term, const DecayedCounter& counter) {
+        sqlite3* db = getDatabase();
+        if (!ensureTable(db)) return;
+        sqlite3_stmt* stmt;
+        if (counter.score < RECENCY_MIN_SCORE) {
+            stmt = getStatement(db, "DELETE FROM search_recency WHERE username = ? AND term = ?;");
+        } else {
+            stmt = getStatement(db, "INSERT OR REPLACE INTO search_recency (username, term, score, updated) VALUES (?, ?, ?, ?);");
+        }
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 2, term.c_str(), -1, SQLITE_STATIC);
+            if (counter.score >= RECENCY_MIN_SCORE) {
+                sqlite3_bind_double(stmt, 3, counter.score);
+                sqlite3_bind_int64(stmt, 4, counter.updated);
             }
-            node = node->children[ch];
+            sqlite3_step(stmt);
         }
-        node->isEndOfWord = true;
+        sqlite3_reset(stmt);
     }
 
-    // Returns a vector of suggestions for a given prefix
-    vector<string> suggest(const string& prefix, int limit) {
-        string lowerPrefix = prefix;
-        transform(lowerPrefix.begin(), lowerPrefix.end(), lowerPrefix.begin(), ::tolower);
-
-        TrieNode* node = root;
-        for (char ch : lowerPrefix) {
-            if (node->children.find(ch) == node->children.end()) {
-                return {}; // No suggestions found
+    // Users with no counters yet start from their existing search_history rows
+    void seed(const string& user, UserRecency& recency) {
+        sqlite3* db = getDatabase();
+        sqlite3_stmt* stmt = getStatement(db, "SELECT lower(search_term), strftime('%s', timestamp) "
+                                              "FROM search_history WHERE username = ?;");
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char* term = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                if (term) recency.counter(foldKey(term)).add(1, sqlite3_column_int64(stmt, 1));
             }
-            node = node->children[ch];
         }
+        sqlite3_reset(stmt);
+        if (recency.terms.empty()) return;
 
-        vector<string> results;
-        dfs(node, lowerPrefix, results, limit);
-        return results;
+        sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+        for (const auto& entry : recency.terms) store(user, entry.first, entry.second);
+        sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
     }
-};
 
-// --- UTILITY FUNCTIONS ---
-string trim(const string &s) {
-    size_t start = s.find_first_not_of(" \t\n\r");
-    if (string::npos == start) return "";
-    size_t end = s.find_last_not_of(" \t\n\r");
-    return s.substr(start, end - start + 1);
-}
+    UserRecency& load(const string& user) {
+        auto it = users.find(user);
+        if (it != users.end()) return it->second;
 
-string urlDecode(const string &SRC) {
-    string ret;
-    char ch;
-    int i, ii;
-    for (i = 0; i < SRC.length(); i++) {
-        if (SRC[i] == '+') {
-            ret += ' ';
-        } else if (int(SRC[i]) == 37) {
-            sscanf(SRC.substr(i + 1, 2).c_str(), "%x", &ii);
-            ch = static_cast<char>(ii);
-            ret += ch;
-            i = i + 2;
-        } else {
-            ret += SRC[i];
+        UserRecency& recency = users[user];
+        sqlite3* db = getDatabase();
+        if (!ensureTable(db)) return recency;
+        sqlite3_stmt* stmt = getStatement(db, "SELECT term, score, updated FROM search_recency WHERE username = ?;");
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char* term = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                if (!term) continue;
+                DecayedCounter& counter = recency.counter(term);
+                counter.score = sqlite3_column_double(stmt, 1);
+                counter.updated = sqlite3_column_int64(stmt, 2);
+            }
         }
+        sqlite3_reset(stmt);
+        if (recency.terms.empty()) seed(user, recency);
+        return recency;
     }
-    return ret;
-}
 
-string json_escape(const string &s) {
-    stringstream o;
-    for (auto c = s.cbegin(); c != s.cend(); c++) {
-        switch (*c) {
-            case '"': o << "\\\""; break;
-            case '\\': o << "\\\\"; break;
-            case '\b': o << "\\b"; break;
-            case '\f': o << "\\f"; break;
-            case '\n': o << "\\n"; break;
-            case '\r': o << "\\r"; break;
-            case '\t': o << "\\t"; break;
-            default:
-                if ('\x00' <= *c && *c <= '\x1f') {
-                    o << "\\u" << hex << setfill('0') << setw(4) << static_cast<int>(*c);
-                } else {
-                    o << *c;
-                }
-        }
+public:
+    const UserRecency& get(const string& user) {
+        return load(user);
     }
-    return o.str();
+
+    // Counts a search of term by user. Call it before inserting the search_history
+    // row, since a user's first load seeds the counters from that table.
+    void record(const string& user, const string& term, int64_t now) {
+        UserRecency& recency = load(user);
+        string lowerTerm = foldKey(term);
+        DecayedCounter& counter = recency.counter(lowerTerm);
+        counter.add(1, now);
+        store(user, lowerTerm, counter);
+    }
+
+    // Takes back one search of term made at `when`, e.g. after its history row was deleted
+    void remove(const string& user, const string& term, int64_t when, int64_t now) {
+        UserRecency& recency = load(user);
+        string lowerTerm = foldKey(term);
+        auto it = recency.terms.find(lowerTerm);
+        if (it == recency.terms.end()) return;
+        DecayedCounter& counter = it->second;
+        counter.add(-DecayedCounter{1, when}.at(now), now);
+        store(user, lowerTerm, counter);
+        if (counter.score < RECENCY_MIN_SCORE) recency.erase(lowerTerm);
+    }
+};
+
+RecencyScores recencyScores;
+
+// Score boosts for the user's terms that complete query, by lowercase term
+map<string, uint32_t> historyBoosts(const UserRecency& recency, const string& query, int64_t now) {
+    string lowerQuery = foldKey(query);
+    map<string, uint32_t> boosts;
+    for (auto it = recency.terms.lower_bound(lowerQuery);
+         it != recency.terms.end() && it->first.compare(0, lowerQuery.size(), lowerQuery) == 0; ++it) {
+        double boost = HISTORY_BOOST * it->second.at(now);
+        if (boost >= 1) boosts[it->first] = static_cast<uint32_t>(min<double>(boost, UINT32_MAX));
+    }
+    return boosts;
 }
 
-//extracts a specific piece of information from a URL's query string
-string getQueryParam(const string &query, const string &key) {
-    size_t pos = query.find(key + "=");
-    if (pos == string::npos) return "";
-    size_t start = pos + key.length() + 1;
-    size_t end = query.find("&", start);
-    return urlDecode(query.substr(start, end == string::npos ? string::npos : end - start));
+
+// --- SUGGESTION PAGING ---
+// A page ends with "next: <file version>~<saved cursor>" when more may follow; pass it back as cursor=
+
+// Reads the n of a "<version>~s<n>" token, or returns false
+bool parseSkipToken(const string& token, const string& version, size_t& skip) {
+    size_t split = token.find('~');
+    if (split == string::npos || token.substr(0, split) != version ||
+        token.compare(split + 1, 1, "s") != 0) return false;
+    try { skip = stoul(token.substr(split + 2)); }
+    catch(...) { return false; }
+    return true;
 }
 
-string join(const vector<string>& vec, const string& delim) {
-    stringstream ss;
-    for (size_t i = 0; i < vec.size(); ++i) {
-        ss << vec[i];
-        if (i < vec.size() - 1) ss << delim;
+vector<string> suggestPage(const Trie& trie, const string& version, const string& query,
+                           const string& token, int limit, string& nextToken,
+                           const map<string, uint32_t>& boosts = {}) {
+    vector<string> results;
+    nextToken.clear();
+    size_t count = static_cast<size_t>(max(limit, 0));
+    string position;
+    if (!token.empty()) {
+        size_t split = token.find('~');
+        if (split == string::npos || token.substr(0, split) != version) return results;
+        position = token.substr(split + 1);
     }
-    return ss.str();
-}
 
-// (NEW) Helper function to load words from a file into the Trie
-void loadWordsIntoTrie(const string& filename, Trie& trie) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        return; // Silently fail if file can't be opened
+    if (trie.hasScores() || !boosts.empty()) {
+        RankedCursor cursor;
+        if (token.empty()) {
+            cursor = trie.rankedCursor(query);
+        } else if (position.empty() || position[0] != 'r' ||
+                   !trie.restoreRanked(query, position.substr(1), cursor)) {
+            return results;
+        }
+        trie.ranked(query, cursor, count, results, boosts);
+        if (!results.empty() && results.size() == count) nextToken = version + "~r" + trie.saveRanked(cursor);
+        return results;
     }
-    string word;
-    while (getline(file, word)) {
-        trie.insert(trim(word));
+
+    TrieCursor cursor;
+    if (token.empty()) {
+        cursor = trie.complete(query);
+    } else if (!trie.restoreCursor(query, position, cursor)) {
+        return results;
     }
-    file.close();
+    trie.next(cursor, results, count);
+    if (count > 0 && !cursor.done()) nextToken = version + "~" + trie.saveCursor(cursor);
+    return results;
 }
 
+// An FstIndex skips whole subtrees by their word counts, so its tokens are always
+// "<file version>~s<n>", however large n is
+vector<string> suggestPage(const FstIndex& fst, const string& version, const string& query,
+                           const string& token, int limit, string& nextToken) {
+    nextToken.clear();
+    size_t skip = 0;
+    if (!token.empty() && !parseSkipToken(token, version, skip)) return {};
+    vector<string> results = fst.suggest(query, limit, skip);
+    if (!results.empty() && results.size() == static_cast<size_t>(limit)) {
+        nextToken = version + "~s" + to_string(skip + limit);
+    }
+    return results;
+}
 
-// --- MAIN LOGIC ---
-int main() {
-    const string DB_PATH = "../sqlite/users.db";
-
-    const char* request_method_cstr = getenv("REQUEST_METHOD");
-    string method = request_method_cstr ? request_method_cstr : "";
-    
-    const char* query_string_cstr = getenv("QUERY_STRING");
-    string queryStr = query_string_cstr ? query_string_cstr : "";
 
+// --- REQUEST HANDLING ---
+// Handles one request. The response is written CGI-style (headers, blank line, body).
+int handleRequest(const string& method, const string& queryStr, istream& in, ostream& out) {
     string user = getQueryParam(queryStr, "user");
     string query = getQueryParam(queryStr, "query");
     string filename = getQueryParam(queryStr, "filename");
@@ -189,82 +2927,76 @@ int main() {
 
     // === HANDLE PROFILE DATA REQUEST ===
     if (getQueryParam(queryStr, "get_profile") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         string password = "";
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "SELECT password FROM users WHERE username = ?;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT password FROM users WHERE username = ?;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 if (sqlite3_step(stmt) == SQLITE_ROW) {
                     password = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
                 }
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "{\"username\":\"" << json_escape(user) << "\",\"password\":\"" << json_escape(password) << "\"}";
+        out << "{\"username\":\"" << json_escape(user) << "\",\"password\":\"" << json_escape(password) << "\"}";
         return 0;
     }
 
     // === HANDLE PASSWORD UPDATE (POST) ===
     if (method == "POST" && getQueryParam(queryStr, "update_password") == "1") {
-        cout << "Content-Type: text/plain\r\n\r\n";
+        out << "Content-Type: text/plain\r\n\r\n";
         string newPassword;
         char c;
-        while(cin.get(c)) { newPassword += c; }
+        while(in.get(c)) { newPassword += c; }
 
-        sqlite3* db;
+        sqlite3* db = getDatabase();
         int rc = -1;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "UPDATE users SET password = ? WHERE username = ?;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "UPDATE users SET password = ? WHERE username = ?;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, newPassword.c_str(), -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);
                 rc = sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
 
         if (rc == SQLITE_DONE) {
-            cout << "Password updated successfully!";
+            out << "Password updated successfully!";
         } else {
-            cout << "Failed to update password.";
+            out << "Failed to update password.";
         }
         return 0;
     }
 
     // === HANDLE SETTINGS REQUESTS ===
     if (getQueryParam(queryStr, "get_settings") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         string theme = "light";
         int suggestions_count = 10;
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "SELECT theme, suggestions_count FROM user_preferences WHERE username = ?;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT theme, suggestions_count FROM user_preferences WHERE username = ?;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 if (sqlite3_step(stmt) == SQLITE_ROW) {
                     theme = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
                     suggestions_count = sqlite3_column_int(stmt, 1);
                 }
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "{\"theme\":\"" << theme << "\",\"suggestions_count\":" << suggestions_count << "}";
+        out << "{\"theme\":\"" << theme << "\",\"suggestions_count\":" << suggestions_count << "}";
         return 0;
     }
 
     if (method == "POST" && getQueryParam(queryStr, "save_settings") == "1") {
-        cout << "Content-Type: text/plain\r\n\r\n";
+        out << "Content-Type: text/plain\r\n\r\n";
         string requestBody;
         char c;
-        while(cin.get(c)) { requestBody += c; }
+        while(in.get(c)) { requestBody += c; }
         
         string theme = "light";
         size_t theme_pos = requestBody.find("\"theme\":\"");
@@ -283,93 +3015,136 @@ int main() {
             catch(...) { suggestions_count = 10; }
         }
 
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "INSERT OR REPLACE INTO user_preferences (username, theme, suggestions_count) VALUES (?, ?, ?);";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "INSERT OR REPLACE INTO user_preferences (username, theme, suggestions_count) VALUES (?, ?, ?);");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, theme.c_str(), -1, SQLITE_STATIC);
                 sqlite3_bind_int(stmt, 3, suggestions_count);
                 sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "Settings saved successfully!";
+        out << "Settings saved successfully!";
         return 0;
     }
 
     // === HANDLE FILE UPLOAD (POST) ===
+    // With append=1 the words are added to the user's current list (if any) instead,
+    // updating its index rather than rebuilding it
     if (method == "POST" && !filename.empty()) {
-        cout << "Content-Type: text/plain\r\n\r\n";
+        out << "Content-Type: text/plain\r\n\r\n";
+        if (isIndexFileName(filename)) {
+            out << "File names ending in .idx or .idx.tmp are reserved for indexes.";
+            return 0;
+        }
         string fileData;
         char c;
-        while (cin.get(c)) { fileData += c; }
+        while (in.get(c)) { fileData += c; }
+
+        sqlite3* db = getDatabase();
+        string target;
+        if (db && getQueryParam(queryStr, "append") == "1") {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT filename FROM uploads WHERE username = ? ORDER BY upload_time DESC LIMIT 1;");
+            if (stmt) {
+                sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
+                if (sqlite3_step(stmt) == SQLITE_ROW) {
+                    const char* fname = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                    if (fname) target = string(fname);
+                }
+            }
+            sqlite3_reset(stmt);
+        }
+
+        struct stat before, info;
+        if (!target.empty() && !isIndexFileName(target) && stat(("../uploaded/" + target).c_str(), &before) == 0) {
+            string path = "../uploaded/" + target;
+            ofstream file(path, ios::app | ios::binary);
+            if (before.st_size > 0) {
+                // Start on a new line if the list doesn't end with one
+                ifstream last(path, ios::binary);
+                last.seekg(before.st_size - 1);
+                if (last.get() != '\n') file << '\n';
+            }
+            file << fileData;
+            file.close();
+            indexCache.erase(path);
+
+            if (stat(path.c_str(), &info) == 0) {
+                appendToIndex(path, before, info, fileData);
+            }
+            out << "Words added to " << target << ".";
+            return 0;
+        }
 
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "INSERT INTO uploads (username, filename) VALUES (?, ?);";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "INSERT INTO uploads (username, filename) VALUES (?, ?);");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, filename.c_str(), -1, SQLITE_STATIC);
                 sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
 
-        ofstream out("../uploaded/" + filename);
-        out << fileData;
-        out.close();
-        cout << "File uploaded successfully.";
+        string path = "../uploaded/" + filename;
+        ofstream file(path);
+        file << fileData;
+        file.close();
+        // The mtime check would catch this too, but not a same-size rewrite within one second
+        indexCache.erase(path);
+
+        if (stat(path.c_str(), &info) == 0) {
+            if (heldAsFst(info)) {
+                remove(indexPathFor(path).c_str()); // left by an earlier, smaller upload
+            } else {
+                compileIndex(path, info);
+            }
+        }
+        out << "File uploaded successfully.";
         return 0;
     }
 
     // === HANDLE SAVING A SEARCH (POST) ===
     if (method == "POST" && getQueryParam(queryStr, "save_search") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         string term_to_save = getQueryParam(queryStr, "term");
 
         if (user.empty() || term_to_save.empty()) {
-            cout << "{\"success\":false,\"error\":\"Missing user or term parameter\"}";
+            out << "{\"success\":false,\"error\":\"Missing user or term parameter\"}";
             return 0;
         }
 
-        sqlite3* db;
-        sqlite3_open(DB_PATH.c_str(), &db);
-        string sql = "INSERT OR IGNORE INTO saved_searches (username, search_term) VALUES (?, ?);";
-        sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        sqlite3_stmt* stmt = getStatement(db, "INSERT OR IGNORE INTO saved_searches (username, search_term) VALUES (?, ?);");
+        if (stmt) {
             sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
             sqlite3_bind_text(stmt, 2, term_to_save.c_str(), -1, SQLITE_STATIC);
             if (sqlite3_step(stmt) == SQLITE_DONE) {
                  if (sqlite3_changes(db) > 0) {
-                    cout << "{\"success\":true,\"message\":\"Search saved successfully\"}";
+                    out << "{\"success\":true,\"message\":\"Search saved successfully\"}";
                  } else {
-                    cout << "{\"success\":true,\"message\":\"Search was already saved\"}";
+                    out << "{\"success\":true,\"message\":\"Search was already saved\"}";
                  }
             } else {
-                cout << "{\"success\":false,\"error\":\"Failed to save search\"}";
+                out << "{\"success\":false,\"error\":\"Failed to save search\"}";
             }
         } else {
-             cout << "{\"success\":false,\"error\":\"SQL preparation failed\"}";
+             out << "{\"success\":false,\"error\":\"SQL preparation failed\"}";
         }
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
+        sqlite3_reset(stmt);
         return 0;
     }
     
     // === HANDLE SAVED SEARCHES REQUEST (GET) ===
     if (getQueryParam(queryStr, "get_saved") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         vector<string> jsonRows;
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "SELECT id, search_term, timestamp FROM saved_searches WHERE username = ? ORDER BY timestamp DESC;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT id, search_term, timestamp FROM saved_searches WHERE username = ? ORDER BY timestamp DESC;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 while (sqlite3_step(stmt) == SQLITE_ROW) {
                     int id = sqlite3_column_int(stmt, 0);
@@ -380,88 +3155,107 @@ int main() {
                     jsonRows.push_back("{\"id\":" + to_string(id) + ",\"search_term\":\"" + json_escape(term) + "\",\"timestamp\":\"" + json_escape(time) + "\"}");
                 }
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "[" << join(jsonRows, ",") << "]";
+        out << "[" << join(jsonRows, ",") << "]";
         return 0;
     }
 
     // === HANDLE DELETE SAVED SEARCH ITEM (POST) ===
     if (method == "POST" && getQueryParam(queryStr, "delete_saved") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         
         string saved_id = getQueryParam(queryStr, "saved_id");
         
         if (saved_id.empty()) {
-            cout << "{\"success\":false,\"error\":\"Missing saved_id parameter\"}";
+            out << "{\"success\":false,\"error\":\"Missing saved_id parameter\"}";
+            return 0;
+        }
+        int savedId;
+        if (!parseRowId(saved_id, savedId)) {
+            out << "{\"success\":false,\"error\":\"Invalid saved_id parameter\"}";
             return 0;
         }
 
-        sqlite3* db;
+        sqlite3* db = getDatabase();
         int rc = -1;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "DELETE FROM saved_searches WHERE id = ? AND username = ?;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
-                sqlite3_bind_int(stmt, 1, stoi(saved_id));
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "DELETE FROM saved_searches WHERE id = ? AND username = ?;");
+            if (stmt) {
+                sqlite3_bind_int(stmt, 1, savedId);
                 sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);
                 rc = sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
 
         if (rc == SQLITE_DONE) {
-            cout << "{\"success\":true,\"message\":\"Saved search deleted successfully\"}";
+            out << "{\"success\":true,\"message\":\"Saved search deleted successfully\"}";
         } else {
-            cout << "{\"success\":false,\"error\":\"Failed to delete saved search\"}";
+            out << "{\"success\":false,\"error\":\"Failed to delete saved search\"}";
         }
         return 0;
     }
 
     // === HANDLE DELETE HISTORY ITEM (POST) ===
     if (method == "POST" && getQueryParam(queryStr, "delete_history") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         
         string history_id = getQueryParam(queryStr, "history_id");
         
         if (history_id.empty()) {
-            cout << "{\"success\":false,\"error\":\"Missing history_id parameter\"}";
+            out << "{\"success\":false,\"error\":\"Missing history_id parameter\"}";
+            return 0;
+        }
+        int historyId;
+        if (!parseRowId(history_id, historyId)) {
+            out << "{\"success\":false,\"error\":\"Invalid history_id parameter\"}";
             return 0;
         }
 
-        sqlite3* db;
+        sqlite3* db = getDatabase();
         int rc = -1;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "DELETE FROM search_history WHERE id = ? AND username = ?;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
-                sqlite3_bind_int(stmt, 1, stoi(history_id));
+        string term;
+        int64_t when = 0;
+        if (db) {
+            // The row's search is taken back out of the user's recency counter
+            sqlite3_stmt* stmt = getStatement(db, "SELECT search_term, strftime('%s', timestamp) FROM search_history WHERE id = ? AND username = ?;");
+            if (stmt) {
+                sqlite3_bind_int(stmt, 1, historyId);
+                sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);
+                if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+                    term = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                    when = sqlite3_column_int64(stmt, 1);
+                }
+            }
+            sqlite3_reset(stmt);
+
+            stmt = getStatement(db, "DELETE FROM search_history WHERE id = ? AND username = ?;");
+            if (stmt) {
+                sqlite3_bind_int(stmt, 1, historyId);
                 sqlite3_bind_text(stmt, 2, user.c_str(), -1, SQLITE_STATIC);
                 rc = sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
 
         if (rc == SQLITE_DONE) {
-            cout << "{\"success\":true,\"message\":\"History item deleted successfully\"}";
+            if (!term.empty()) recencyScores.remove(user, term, when, time(nullptr));
+            out << "{\"success\":true,\"message\":\"History item deleted successfully\"}";
         } else {
-            cout << "{\"success\":false,\"error\":\"Failed to delete history item\"}";
+            out << "{\"success\":false,\"error\":\"Failed to delete history item\"}";
         }
         return 0;
     }
 
     // === HANDLE HISTORY REQUEST (GET) ===
     if (getQueryParam(queryStr, "history") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         vector<string> jsonRows;
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "SELECT id, search_term, timestamp FROM search_history WHERE username = ? ORDER BY timestamp DESC LIMIT 50;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT id, search_term, timestamp FROM search_history WHERE username = ? ORDER BY timestamp DESC LIMIT 50;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 while (sqlite3_step(stmt) == SQLITE_ROW) {
                     int id = sqlite3_column_int(stmt, 0);
@@ -472,22 +3266,20 @@ int main() {
                     jsonRows.push_back("{\"id\":" + to_string(id) + ",\"search_term\":\"" + json_escape(term) + "\",\"timestamp\":\"" + json_escape(time) + "\"}");
                 }
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "[" << join(jsonRows, ",") << "]";
+        out << "[" << join(jsonRows, ",") << "]";
         return 0;
     }
 
     // === HANDLE UPLOADS LIST REQUEST (GET) ===
     if (getQueryParam(queryStr, "uploads") == "1") {
-        cout << "Content-Type: application/json\r\n\r\n";
+        out << "Content-Type: application/json\r\n\r\n";
         vector<string> jsonRows;
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "SELECT filename, upload_time FROM uploads WHERE username = ? ORDER BY upload_time DESC;";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3* db = getDatabase();
+        if (db) {
+            sqlite3_stmt* stmt = getStatement(db, "SELECT filename, upload_time FROM uploads WHERE username = ? ORDER BY upload_time DESC;");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 while (sqlite3_step(stmt) == SQLITE_ROW) {
                     const char* fname = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
@@ -495,74 +3287,94 @@ int main() {
                     jsonRows.push_back("{\"filename\":\"" + json_escape(string(fname)) + "\",\"upload_time\":\"" + json_escape(string(time)) + "\"}");
                 }
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "[" << join(jsonRows, ",") << "]";
+        out << "[" << join(jsonRows, ",") << "]";
         return 0;
     }
 
     // === HANDLE LOGGING A SEARCH (GET) ===
     if (getQueryParam(queryStr, "log") == "1") {
-        cout << "Content-Type: text/plain\r\n\r\n";
-        sqlite3* db;
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string sql = "INSERT INTO search_history (username, search_term) VALUES (?, ?);";
-            sqlite3_stmt* stmt;
-            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
+        out << "Content-Type: text/plain\r\n\r\n";
+        sqlite3* db = getDatabase();
+        if (db) {
+            recencyScores.record(user, query, time(nullptr));
+            sqlite3_stmt* stmt = getStatement(db, "INSERT INTO search_history (username, search_term) VALUES (?, ?);");
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, query.c_str(), -1, SQLITE_STATIC);
                 sqlite3_step(stmt);
             }
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
         }
-        cout << "Logged: " << query;
+        out << "Logged: " << query;
         return 0;
     }
     
     // === (MODIFIED) HANDLE AUTOCOMPLETE SUGGESTIONS (GET) USING TRIE ===
     if (!query.empty()) {
-        cout << "Content-Type: text/plain\r\n\r\n";
+        out << "Content-Type: text/plain\r\n\r\n";
         
         string current_filename = "";
-        sqlite3* db;
+        sqlite3* db = getDatabase();
         int suggestions_limit = 10;
 
         // 1. Get user's suggestion limit and most recent filename from the database
-        if (sqlite3_open(DB_PATH.c_str(), &db) == SQLITE_OK) {
-            string pref_sql = "SELECT suggestions_count FROM user_preferences WHERE username = ?;";
-            sqlite3_stmt* pref_stmt;
-            if (sqlite3_prepare_v2(db, pref_sql.c_str(), -1, &pref_stmt, 0) == SQLITE_OK) {
+        if (db) {
+            sqlite3_stmt* pref_stmt = getStatement(db, "SELECT suggestions_count FROM user_preferences WHERE username = ?;");
+            if (pref_stmt) {
                 sqlite3_bind_text(pref_stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 if (sqlite3_step(pref_stmt) == SQLITE_ROW) { 
                     suggestions_limit = sqlite3_column_int(pref_stmt, 0); 
                 }
             }
-            sqlite3_finalize(pref_stmt);
+            sqlite3_reset(pref_stmt);
 
-            string file_sql = "SELECT filename FROM uploads WHERE username = ? ORDER BY upload_time DESC LIMIT 1;";
-            sqlite3_stmt* file_stmt;
-            if (sqlite3_prepare_v2(db, file_sql.c_str(), -1, &file_stmt, 0) == SQLITE_OK) {
+            sqlite3_stmt* file_stmt = getStatement(db, "SELECT filename FROM uploads WHERE username = ? ORDER BY upload_time DESC LIMIT 1;");
+            if (file_stmt) {
                 sqlite3_bind_text(file_stmt, 1, user.c_str(), -1, SQLITE_STATIC);
                 if (sqlite3_step(file_stmt) == SQLITE_ROW) {
                     const char* fname = reinterpret_cast<const char*>(sqlite3_column_text(file_stmt, 0));
                     if (fname) current_filename = string(fname);
                 }
             }
-            sqlite3_finalize(file_stmt);
-            sqlite3_close(db);
+            sqlite3_reset(file_stmt);
         }
 
-        // 2. If a file exists, load it into the Trie and get suggestions
+        // 2. If a file exists, get a page of suggestions from its cached index
         if (!current_filename.empty()) {
-            Trie trie;
-            loadWordsIntoTrie("../uploaded/" + current_filename, trie);
-            
-            vector<string> results = trie.suggest(query, suggestions_limit);
+            string path = "../uploaded/" + current_filename;
+            SuggestionIndex index = indexCache.get(path, indexCacheBudget);
+            map<string, uint32_t> boosts = historyBoosts(recencyScores.get(user), query, time(nullptr));
+            string nextToken;
+            vector<string> results;
+            // fuzzy=k typos, infix=1 anywhere in a word, tokens=1 any word of a line (one page, Tries only)
+            int fuzzy = atoi(getQueryParam(queryStr, "fuzzy").c_str());
+            if (getQueryParam(queryStr, "infix") == "1" && index.trie) {
+                string lowerQuery = foldKey(query);
+                vector<uint32_t> ids;
+                // nullptr when the list's file is gone: no matches rather than a crash
+                shared_ptr<SubstringIndex> infix = indexCache.secondary(path, indexCacheBudget, &SuggestionIndex::infix);
+                if (infix) infix->matches(lowerQuery, ids);
+                results = index.trie->bestOf(ids, suggestions_limit);
+            } else if (getQueryParam(queryStr, "tokens") == "1" && index.trie) {
+                vector<uint32_t> ids;
+                shared_ptr<TokenIndex> tokens = indexCache.secondary(path, indexCacheBudget, &SuggestionIndex::tokens);
+                if (tokens) tokens->matches(query, ids);
+                results = index.trie->bestOf(ids, suggestions_limit);
+            } else if (fuzzy > 0 && index.trie) {
+                results = index.trie->fuzzySuggest(query, min(fuzzy, FUZZY_MAX_EDITS), suggestions_limit);
+            } else if (index.fst) {
+                results = suggestPage(*index.fst, fileVersion(path), query, getQueryParam(queryStr, "cursor"), suggestions_limit, nextToken);
+            } else {
+                results = suggestPage(*index.trie, fileVersion(path), query, getQueryParam(queryStr, "cursor"), suggestions_limit, nextToken, boosts);
+            }
 
             for(const auto& res : results) {
-                cout << " - " << res << "\n";
+                out << " - " << res << "\n";
+            }
+            if (!nextToken.empty()) {
+                out << "next: " << nextToken << "\n";
             }
         }
         
@@ -570,7 +3382,487 @@ int main() {
     }
 
     // Fallback for invalid requests
-    cout << "Content-Type: text/plain\r\n\r\n";
-    cout << "No valid request parameters provided.";
+    out << "Content-Type: text/plain\r\n\r\n";
+    out << "No valid request parameters provided.";
+    return 0;
+}
+
+// --- SERVER MODE ---
+// `search.cgi --serve [port]` answers HTTP/1.1 on 127.0.0.1, e.g. behind Apache's
+//   ProxyPass /cgi-bin/search.cgi http://127.0.0.1:8090/
+#ifndef _WIN32
+mutex requestMutex;
+
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Reads one HTTP request from fd into method/target/body. `buffer` carries bytes of the
+// next pipelined request between calls. Returns false when the connection should close.
+bool readHttpRequest(int fd, string& buffer, string& method, string& target, string& body, bool& keepAlive) {
+    const size_t MAX_HEADER_SIZE = 64 * 1024;
+    size_t headerEnd;
+    char chunk[8192];
+    while ((headerEnd = buffer.find("\r\n\r\n")) == string::npos) {
+        if (buffer.size() > MAX_HEADER_SIZE) return false;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+
+    istringstream headers(buffer.substr(0, headerEnd));
+    string requestLine, version;
+    getline(headers, requestLine);
+    istringstream(requestLine) >> method >> target >> version;
+    if (method.empty() || target.empty()) return false;
+
+    keepAlive = (version == "HTTP/1.1");
+    size_t contentLength = 0;
+    string line;
+    while (getline(headers, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string name = line.substr(0, colon);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        string value = trim(line.substr(colon + 1));
+        transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (name == "content-length") {
+            try { contentLength = stoul(value); }
+            catch(...) { return false; }
+        } else if (name == "connection") {
+            if (value == "close") keepAlive = false;
+            if (value == "keep-alive") keepAlive = true;
+        }
+    }
+
+    buffer.erase(0, headerEnd + 4);
+    while (buffer.size() < contentLength) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    body = buffer.substr(0, contentLength);
+    buffer.erase(0, contentLength);
+    return true;
+}
+
+void serveConnection(int fd) {
+    timeval timeout = {30, 0}; // drop idle keep-alive connections
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    string buffer, method, target, body;
+    bool keepAlive = false;
+    while (readHttpRequest(fd, buffer, method, target, body, keepAlive)) {
+        size_t qpos = target.find('?');
+        string queryStr = qpos == string::npos ? "" : target.substr(qpos + 1);
+
+        istringstream in(body);
+        ostringstream out;
+        string status = "200 OK";
+        try {
+            lock_guard<mutex> lock(requestMutex);
+            handleRequest(method, queryStr, in, out);
+        } catch (const exception& e) {
+            // One bad request must not take the whole daemon down
+            cerr << "request failed: " << e.what() << endl;
+            status = "500 Internal Server Error";
+            out.str("");
+            out << "Content-Type: text/plain\r\n\r\nInternal error.";
+        }
+
+        // Translate the CGI-style output into an HTTP response
+        string cgiOutput = out.str();
+        string contentType = "text/plain";
+        size_t split = cgiOutput.find("\r\n\r\n");
+        string responseBody = cgiOutput;
+        if (split != string::npos) {
+            string header = cgiOutput.substr(0, split);
+            size_t colon = header.find(':');
+            if (colon != string::npos) contentType = trim(header.substr(colon + 1));
+            responseBody = cgiOutput.substr(split + 4);
+        }
+
+        string response = "HTTP/1.1 " + status + "\r\n"
+                          "Content-Type: " + contentType + "\r\n"
+                          "Content-Length: " + to_string(responseBody.size()) + "\r\n"
+                          "Connection: " + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n" + responseBody;
+        if (!sendAll(fd, response) || !keepAlive) break;
+    }
+    close(fd);
+}
+
+int runServer(int port) {
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listener, 64) < 0) {
+        perror("bind");
+        close(listener);
+        return 1;
+    }
+    cerr << "search server listening on 127.0.0.1:" << port << endl;
+
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        thread(serveConnection, fd).detach();
+    }
+    close(listener);
+    return 0;
+}
+#else
+int runServer(int) {
+    cerr << "Server mode is not supported on Windows; run search.cgi as a CGI script." << endl;
+    return 1;
+}
+#endif
+
+
+// --- BENCHMARK MODE ---
+// `search.cgi --bench <wordfile>` reports build and lookup speed and memory per index type;
+// -DSEARCH_COUNT_ALLOCATIONS adds heap allocations per suggest() call
+#ifdef SEARCH_COUNT_ALLOCATIONS
+size_t allocationCount = 0;
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+// Every delete frees through this one out-of-line call; with free() inlined into each
+// delete, GCC reports the operator new/free pairs as mismatched (-Wmismatched-new-delete)
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void releaseCounted(void* p) noexcept { free(p); }
+void operator delete(void* p) noexcept { releaseCounted(p); }
+void operator delete(void* p, size_t) noexcept { releaseCounted(p); }
+void operator delete[](void* p) noexcept { releaseCounted(p); }
+void operator delete[](void* p, size_t) noexcept { releaseCounted(p); }
+#endif
+
+int runBenchmark(const string& path) {
+    using Clock = chrono::steady_clock;
+    auto seconds = [](Clock::time_point start) {
+        return chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    vector<string> words;
+    ifstream file(path);
+    string line;
+    Clock::time_point start = Clock::now();
+    while (getline(file, line)) {
+        string word = trim(line);
+        if (!word.empty()) words.push_back(word);
+    }
+    double getlineTime = seconds(start);
+    if (words.empty()) {
+        cerr << "No words read from " << path << endl;
+        return 1;
+    }
+
+    const char* layoutNames[] = {"", "sorted", "dense", "adaptive"};
+    cout << "layout:  " << layoutNames[TRIE_NODE_LAYOUT] << "\n";
+    cout << "words:   " << words.size() << "\n";
+
+    // Reading the file alone: getline and trim against the mapped line scanner, then
+    // the whole of loadWordsIntoTrie
+    struct stat info;
+    double megabytes = stat(path.c_str(), &info) == 0 ? info.st_size / (1024.0 * 1024.0) : 0;
+    size_t scanned = 0;
+    start = Clock::now();
+    forEachWord(path, [&](const char*, size_t length, uint32_t) { scanned += length; });
+    double scanTime = seconds(start);
+    cout << "parse:   " << fixed << setprecision(0) << megabytes / getlineTime << " MB/s getline, "
+         << megabytes / scanTime << " MB/s scanner (" << scanned / 1024 << " KB of words)\n";
+    {
+        Trie loaded;
+        start = Clock::now();
+        loadWordsIntoTrie(path, loaded);
+        cout << "load:    " << megabytes / seconds(start) << " MB/s (file to Trie with top-k lists)\n";
+    }
+
+    cout << "paths:   " << (TRIE_PATH_COMPRESSION ? "compressed" : "one node per character") << "\n";
+
+    Trie trie;
+    start = Clock::now();
+    for (const auto& word : words) trie.insert(word);
+    double buildTime = seconds(start);
+    cout << "insert:  " << fixed << setprecision(0) << words.size() / buildTime / 1e3 << " k words/s ("
+         << buildTime * 1000 << " ms)\n";
+    {
+        vector<WordSpan> spans;
+        for (const auto& word : words) spans.push_back({word.data(), word.size(), 0});
+        Trie bulk;
+        start = Clock::now();
+        bulk.bulkLoad(spans, buildThreadCount());
+        double bulkTime = seconds(start);
+        cout << "bulk:    " << words.size() / bulkTime / 1e3 << " k words/s (" << bulkTime * 1000
+             << " ms, " << buildThreadCount() << " threads requested, laid out depth-first)\n";
+        size_t queries = 0, results = 0;
+        start = Clock::now();
+        for (size_t w = 0; w < words.size(); w += 16) {
+            for (size_t len = 1; len <= 4 && len <= words[w].size(); len++, queries++) {
+                results += bulk.suggest(words[w].substr(0, len), 10).size();
+            }
+        }
+        double lookupTime = seconds(start);
+        cout << "bulk:    " << queries / lookupTime / 1e3 << " k dfs queries/s (" << lookupTime * 1000 << " ms, "
+             << results << " results)\n";
+    }
+
+    // Prefix lookups: the first 1..4 characters of every 16th word, 10 suggestions each
+    vector<string> prefixes;
+    for (size_t w = 0; w < words.size(); w += 16) {
+        for (size_t len = 1; len <= 4 && len <= words[w].size(); len++) {
+            prefixes.push_back(words[w].substr(0, len));
+        }
+    }
+    auto runQueries = [&](const char* name) {
+        size_t results = 0;
+#ifdef SEARCH_COUNT_ALLOCATIONS
+        size_t allocationsBefore = allocationCount;
+#endif
+        Clock::time_point queryStart = Clock::now();
+        for (const auto& prefix : prefixes) {
+            results += trie.suggest(prefix, 10).size();
+        }
+        double lookupTime = seconds(queryStart);
+        cout << name << setprecision(0) << prefixes.size() / lookupTime / 1e3 << " k queries/s ("
+             << lookupTime * 1000 << " ms, " << results << " results)\n";
+#ifdef SEARCH_COUNT_ALLOCATIONS
+        cout << "         " << setprecision(2) << double(allocationCount - allocationsBefore) / prefixes.size()
+             << " allocations per query\n";
+#endif
+    };
+    runQueries("dfs:     ");
+
+    start = Clock::now();
+    trie.buildTopCompletions(TRIE_TOP_K);
+    cout << "top-k:   " << setprecision(0) << TRIE_TOP_K << " per node (" << seconds(start) * 1000 << " ms)\n";
+    cout << "memory:  " << setprecision(1) << trie.memoryUsage() / (1024.0 * 1024.0) << " MB ("
+         << trie.nodeCount() << " nodes)\n";
+    runQueries("top-k:   ");
+    {
+        // Best-first search past the end of the top-K lists, as used for ranked pages
+        size_t results = 0;
+        vector<string> page;
+        start = Clock::now();
+        for (const auto& prefix : prefixes) {
+            page.clear();
+            RankedCursor cursor = trie.rankedCursor(prefix);
+            trie.ranked(prefix, cursor, 50, page);
+            results += page.size();
+        }
+        double lookupTime = seconds(start);
+        cout << "ranked:  " << setprecision(0) << prefixes.size() / lookupTime / 1e3 << " k queries/s ("
+             << lookupTime * 1000 << " ms, " << results << " results, best-first 50 per query)\n";
+    }
+
+    {
+        // Typo-tolerant lookups: every 8th prefix with its second character replaced
+        size_t results = 0;
+        vector<string> typos;
+        for (size_t i = 0; i < prefixes.size(); i += 8) {
+            string typo = prefixes[i];
+            if (typo.size() > 1) typo[1] = typo[1] == 'x' ? 'q' : 'x';
+            typos.push_back(typo);
+        }
+        for (int edits = 1; edits <= FUZZY_MAX_EDITS; edits++) {
+            start = Clock::now();
+            for (const auto& typo : typos) results += trie.fuzzySuggest(typo, edits, 10).size();
+            double lookupTime = seconds(start);
+            cout << "fuzzy=" << edits << ": " << setprecision(0) << typos.size() / lookupTime / 1e3 << " k queries/s ("
+                 << lookupTime * 1000 << " ms, " << results << " results)\n";
+            results = 0;
+        }
+    }
+
+    {
+        // Substring index over the same words, queried with fragments from mid-word
+        SubstringIndex infix;
+        start = Clock::now();
+        infix.build(trie, buildThreadCount());
+        cout << "infix:   " << setprecision(0) << seconds(start) * 1000 << " ms to build, "
+             << setprecision(1) << infix.memoryUsage() / (1024.0 * 1024.0) << " MB (" << infix.suffixCount()
+             << " suffixes, " << double(infix.memoryUsage()) / max<size_t>(trie.wordCount(), 1) << " bytes per word)\n";
+        vector<string> fragments;
+        for (size_t w = 0; w < words.size(); w += 128) {
+            string lower = foldKey(words[w]);
+            if (lower.size() >= 5) fragments.push_back(lower.substr(lower.size() / 2 - 1, 3));
+        }
+        size_t results = 0;
+        vector<uint32_t> ids;
+        start = Clock::now();
+        for (const auto& fragment : fragments) {
+            ids.clear();
+            infix.matches(fragment, ids);
+            results += trie.bestOf(ids, 10).size();
+        }
+        double lookupTime = seconds(start);
+        cout << "infix:   " << setprecision(1) << fragments.size() / lookupTime / 1e3 << " k queries/s (" << setprecision(0)
+             << lookupTime * 1000 << " ms, " << results << " results, 3-letter fragments)\n";
+    }
+
+    {
+        // Token index over three-word lines made from the list, queried with one whole
+        // word and the start of another from the same line
+        vector<string> lines;
+        for (size_t w = 0; w < words.size(); w++) {
+            lines.push_back(words[w] + " " + words[w * 7 % words.size()] + " " + words[w * 13 % words.size()]);
+        }
+        vector<WordSpan> spans;
+        for (const auto& line : lines) spans.push_back({line.data(), line.size(), 0});
+        Trie phrases;
+        phrases.bulkLoad(spans, buildThreadCount());
+        TokenIndex tokens;
+        start = Clock::now();
+        tokens.build(phrases, buildThreadCount());
+        cout << "tokens:  " << setprecision(0) << seconds(start) * 1000 << " ms to build over " << lines.size()
+             << " three-word lines, " << setprecision(1) << tokens.memoryUsage() / (1024.0 * 1024.0) << " MB ("
+             << tokens.tokenCount() << " tokens, Trie of the lines " << phrases.memoryUsage() / (1024.0 * 1024.0) << " MB)\n";
+        vector<string> queries;
+        for (size_t w = 0; w < words.size(); w += 16) {
+            queries.push_back(words[w * 13 % words.size()] + " " + words[w * 7 % words.size()].substr(0, 3));
+        }
+        size_t results = 0;
+        vector<uint32_t> ids;
+        start = Clock::now();
+        for (const auto& query : queries) {
+            ids.clear();
+            tokens.matches(query, ids);
+            results += phrases.bestOf(ids, 10).size();
+        }
+        double lookupTime = seconds(start);
+        cout << "tokens:  " << setprecision(0) << queries.size() / lookupTime / 1e3 << " k queries/s ("
+             << lookupTime * 1000 << " ms, " << results << " results, \"<word> <3 letters>\")\n";
+    }
+
+    {
+        // ASCII lowercasing: the old copy + transform(::tolower) against each kernel, on
+        // the query prefixes one at a time and on the whole list as a single buffer
+        string buffer;
+        for (const auto& word : words) buffer += word + "\n";
+        string out;
+        size_t sink = 0;
+        auto measure = [&](const char* name, auto fold) {
+            start = Clock::now();
+            for (int round = 0; round < 20; round++) {
+                for (const auto& prefix : prefixes) sink += fold(prefix.data(), prefix.size());
+            }
+            double shortTime = seconds(start);
+            start = Clock::now();
+            for (int round = 0; round < 20; round++) sink += fold(buffer.data(), buffer.size());
+            double longTime = seconds(start);
+            cout << "lower:   " << name << setprecision(1) << shortTime * 1e9 / (20.0 * prefixes.size())
+                 << " ns per prefix, " << setprecision(0) << 20.0 * buffer.size() / longTime / 1e6 << " MB/s whole list\n";
+        };
+        measure("transform ", [&](const char* text, size_t n) {
+            out.assign(text, n);
+            transform(out.begin(), out.end(), out.begin(), ::tolower);
+            return static_cast<size_t>(out[n - 1]);
+        });
+        auto kernel = [&](LowerAsciiKernel lower) {
+            return [&out, lower](const char* text, size_t n) {
+                out.resize(n);
+                return lower(text, n, &out[0]) + static_cast<size_t>(out[n - 1]);
+            };
+        };
+        measure("scalar    ", kernel(lowerAsciiScalar));
+#ifdef __SSE2__
+        measure("sse2      ", kernel(lowerAsciiSse2));
+#endif
+#ifdef HAVE_AVX2_KERNEL
+        if (__builtin_cpu_supports("avx2")) measure("avx2      ", kernel(lowerAsciiAvx2));
+#endif
+        if (sink == 0) cout << "\n"; // keeps the loops from being optimized away
+    }
+
+    // The same words and queries against the FST backend
+    FstIndex fst;
+    start = Clock::now();
+    for (const auto& word : words) fst.insert(word);
+    fst.freeze();
+    cout << "fst:     " << setprecision(0) << seconds(start) * 1000 << " ms to build, "
+         << setprecision(1) << fst.memoryUsage() / (1024.0 * 1024.0) << " MB (" << fst.stateCount() << " states, "
+         << double(fst.memoryUsage()) / max<size_t>(fst.size(), 1) << " bytes per word)\n";
+    size_t results = 0;
+    start = Clock::now();
+    for (const auto& prefix : prefixes) {
+        results += fst.suggest(prefix, 10).size();
+    }
+    double lookupTime = seconds(start);
+    cout << "fst:     " << setprecision(0) << prefixes.size() / lookupTime / 1e3 << " k queries/s ("
+         << lookupTime * 1000 << " ms, " << results << " results)\n";
     return 0;
-}
\ No newline at end of file
+}
+
+
+// --- MAIN LOGIC ---
+int main(int argc, char* argv[]) {
+    bool serve = false;
+    int port = 8090;
+    string benchPath;
+    // A CGI query string without '=' arrives as argv (RFC 3875 4.4), so under a web
+    // server (GATEWAY_INTERFACE set) the command line is not trusted
+    int flagCount = getenv("GATEWAY_INTERFACE") ? 1 : argc;
+    for (int i = 1; i < flagCount; i++) {
+        string arg = argv[i];
+        if (arg == "--serve") {
+            serve = true;
+            if (i + 1 < flagCount && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                try { port = stoi(argv[++i]); }
+                catch(...) { port = 8090; }
+            }
+        } else if (arg == "--bench" && i + 1 < flagCount) {
+            benchPath = argv[++i];
+        } else if (arg == "--build-threads" && i + 1 < flagCount) {
+            try { buildThreads = stoul(argv[++i]); }
+            catch(...) {}
+        } else if (arg == "--cache-mb" && i + 1 < flagCount) {
+            try { indexCacheBudget = stoul(argv[++i]) * 1024 * 1024; }
+            catch(...) {}
+        } else if (arg == "--strip-accents") {
+            stripAccents = true;
+        } else if (arg == "--fst-min-mb" && i + 1 < flagCount) {
+            try { fstMinBytes = static_cast<off_t>(stoul(argv[++i])) * 1024 * 1024; }
+            catch(...) {}
+        }
+    }
+    if (!benchPath.empty()) {
+        return runBenchmark(benchPath);
+    }
+    if (serve) {
+        return runServer(port);
+    }
+
+    const char* request_method_cstr = getenv("REQUEST_METHOD");
+    string method = request_method_cstr ? request_method_cstr : "";
+    
+    const char* query_string_cstr = getenv("QUERY_STRING");
+    string queryStr = query_string_cstr ? query_string_cstr : "";
+
+    return handleRequest(method, queryStr, cin, cout);
+}